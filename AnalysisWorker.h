@@ -0,0 +1,280 @@
+// Fits of spectrum.C off the GUI thread. Every change of the range, side-bands, peak count,
+// calibration or normalisation, and every peak search, is submitted as an immutable
+// AnalysisRequest; a newer request replaces the queued one and cancels the fit in progress,
+// and only the result of the newest request is handed back. The GUI polls for it from a
+// TTimer, as it does for the list-mode merge, so the canvas and labels are only ever touched
+// on the GUI thread. LatestWorker is that scheme for any job; BootstrapWorker uses it for the
+// band of the efficiency curve.
+#ifndef AnalysisWorker_h
+#define AnalysisWorker_h
+
+#include "SpectrumAnalysis.h"
+#include "PeakSearch.h"
+#include "EfficiencyModel.h"
+#include "SpectrumTimer.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace SpectrumAnalysis
+{
+
+// Runs job(request, cancel) on its own thread for the newest submitted request only. cancel
+// is set when a newer request arrives; the job should then return early, and its result is
+// dropped anyway.
+template <class Request, class Result>
+class LatestWorker
+{
+public:
+  typedef std::function<Result(const Request &, const std::atomic<bool> &)> Job;
+
+  explicit LatestWorker(Job job)
+      : fJob(job), fSubmitted(0), fPendingSerial(0), fRunning(0), fCancel(false), fStop(false), fHasResult(false)
+  {
+    fThread = std::thread(&LatestWorker::Run, this);
+  }
+  ~LatestWorker() { Stop(); }
+  LatestWorker(const LatestWorker &) = delete;
+  LatestWorker &operator=(const LatestWorker &) = delete;
+
+  // Replaces the queued request, if any, and cancels the running one; returns the serial
+  // number of the new request
+  uint64_t Submit(Request request)
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fPending.reset(new Request(std::move(request)));
+    fPendingSerial = ++fSubmitted;
+    if (fRunning)
+      fCancel = true;
+    fWake.notify_all();
+    return fSubmitted;
+  }
+
+  // Moves out the result of the newest request once it is done; false until then
+  bool TakeResult(Result &result, uint64_t *serial = nullptr)
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (!fHasResult)
+      return false;
+    result = std::move(fResult);
+    if (serial)
+      *serial = fResultSerial;
+    fHasResult = false;
+    return true;
+  }
+
+  // A request queued or running, or a result not taken yet
+  bool IsBusy()
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fPending || fRunning || fHasResult;
+  }
+
+  // Blocks until the newest request is done (its result still to be taken)
+  void Wait()
+  {
+    std::unique_lock<std::mutex> lock(fMutex);
+    fIdle.wait(lock, [this]
+               { return fStop || (!fPending && !fRunning); });
+  }
+
+  void Stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+      fCancel = true;
+    }
+    fWake.notify_all();
+    fIdle.notify_all();
+    if (fThread.joinable())
+      fThread.join();
+  }
+
+private:
+  void Run()
+  {
+    std::unique_lock<std::mutex> lock(fMutex);
+    while (true)
+    {
+      fWake.wait(lock, [this]
+                 { return fStop || fPending; });
+      if (fStop)
+        return;
+      std::unique_ptr<Request> request = std::move(fPending);
+      uint64_t serial = fPendingSerial;
+      fRunning = serial;
+      fCancel = false;
+      lock.unlock();
+
+      Result result = fJob(*request, fCancel);
+
+      lock.lock();
+      fRunning = 0;
+      // a cancelled or superseded job is dropped
+      if (serial == fSubmitted)
+      {
+        fResult = std::move(result);
+        fResultSerial = serial;
+        fHasResult = true;
+      }
+      if (!fPending)
+        fIdle.notify_all();
+    }
+  }
+
+  Job fJob;
+  std::mutex fMutex;
+  std::condition_variable fWake, fIdle;
+  std::unique_ptr<Request> fPending;
+  uint64_t fSubmitted, fPendingSerial, fRunning; // serial numbers, fRunning 0 when idle
+  std::atomic<bool> fCancel;
+  bool fStop, fHasResult;
+  Result fResult;
+  uint64_t fResultSerial = 0;
+  std::thread fThread;
+};
+
+// Live time, efficiency and N_gamma as applied to a peak table, frozen with a request
+struct Normalisation
+{
+  double LiveTime = 1, NGamma = 1;
+  bool UseEfficiency = false;
+  std::shared_ptr<const EfficiencyModel> Model; // fitted curve and its band, or else
+  EfficiencyTable Points;                        // the measured points, interpolated, no error
+  double PointsA = 1, PointsB = 0;               // a peak at x is looked up at (x - b)/a
+};
+
+inline void Normalise(std::vector<PeakResult> &peaks, const Normalisation &norm)
+{
+  std::vector<double> positions, efficiency(peaks.size(), 1.), error(peaks.size(), 0.);
+  for (const PeakResult &peak : peaks)
+    positions.push_back(peak.Position);
+  if (norm.UseEfficiency && norm.Model)
+    norm.Model->Eval(positions.data(), positions.size(), efficiency.data(), error.data());
+  else if (norm.UseEfficiency && !norm.Points.X.empty())
+    for (size_t i = 0; i < peaks.size(); i++)
+      efficiency[i] = norm.Points.Eval((positions[i] - norm.PointsB) / norm.PointsA);
+  for (size_t i = 0; i < peaks.size(); i++)
+    NormalisePeak(peaks[i], norm.LiveTime, efficiency[i], error[i], norm.UseEfficiency ? norm.NGamma : 1);
+}
+
+// Bootstrap band of a fitted efficiency curve, made on a copy of it
+struct BootstrapRequest
+{
+  std::shared_ptr<const EfficiencyModel> Model;
+  int NReplicas = 10000;
+  double Xmin = 0, Xmax = 1; // range of the band
+};
+
+inline std::shared_ptr<const EfficiencyModel> RunBootstrap(const BootstrapRequest &request, const std::atomic<bool> &cancel)
+{
+  SpectrumTimer::Scope timer("bootstrap");
+  std::shared_ptr<EfficiencyModel> model = std::make_shared<EfficiencyModel>(*request.Model);
+  model->Bootstrap(request.NReplicas, request.Xmin, request.Xmax, 256, 0, 1, &cancel);
+  return model;
+}
+
+typedef LatestWorker<BootstrapRequest, std::shared_ptr<const EfficiencyModel>> BootstrapWorker;
+
+struct AnalysisRequest
+{
+  enum EMode
+  {
+    kRegion, // Region over Background (DoDraw)
+    kSearch, // every region PeakSearch finds in the view (FindPeaks)
+  };
+  int Mode = kRegion;
+  std::shared_ptr<const Spectrum> Spec; // the shown view, shared by the requests made while it is unchanged
+  RegionDef Region;
+  LinearBackground Background; // side-band line, computed when the request is made
+  PeakSearch::SearchOptions Search;
+  double ChannelWidth = 1; // calibration slope for an energy axis
+  Normalisation Norm;
+};
+
+struct AnalysisResult
+{
+  AnalysisRequest Request;
+  std::vector<RegionDef> Regions;               // Request.Region, or the regions found
+  std::vector<LinearBackground> Lines;          // background under each region
+  std::vector<std::vector<GausPeak>> Peaks;     // by region, sorted by position as Results
+  std::vector<std::vector<PeakResult>> Results; // by region, normalised
+
+  std::vector<PeakResult> GetAllResults() const
+  {
+    std::vector<PeakResult> all;
+    for (const std::vector<PeakResult> &region : Results)
+      all.insert(all.end(), region.begin(), region.end());
+    return all;
+  }
+};
+
+// LatestWorker for AnalysisRequests, with a fit context per core for the peak search
+class AnalysisWorker
+{
+public:
+  // Contexts get ids from firstContextId on, to keep their ROOT names apart from others
+  explicit AnalysisWorker(int firstContextId = 0, int nThreads = 0)
+  {
+    if (nThreads <= 0)
+      nThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < nThreads; i++)
+      fContexts.push_back(new FitContext(firstContextId + i));
+    fWorker.reset(new LatestWorker<AnalysisRequest, AnalysisResult>([this](const AnalysisRequest &request, const std::atomic<bool> &cancel)
+                                                                     { return Analyse(request, cancel); }));
+  }
+  ~AnalysisWorker()
+  {
+    fWorker.reset();
+    for (FitContext *ctx : fContexts)
+      delete ctx;
+  }
+
+  uint64_t Submit(AnalysisRequest request) { return fWorker->Submit(std::move(request)); }
+  bool TakeResult(AnalysisResult &result, uint64_t *serial = nullptr) { return fWorker->TakeResult(result, serial); }
+  bool IsBusy() { return fWorker->IsBusy(); }
+  void Wait() { fWorker->Wait(); }
+  void Stop() { fWorker->Stop(); }
+
+private:
+  AnalysisResult Analyse(const AnalysisRequest &request, const std::atomic<bool> &cancel)
+  {
+    for (FitContext *ctx : fContexts)
+      ctx->SetCancelFlag(&cancel);
+    AnalysisResult result;
+    SpectrumTimer::Scope timer(request.Mode == AnalysisRequest::kSearch ? "peak search" : "analysis");
+    if (request.Mode == AnalysisRequest::kSearch)
+    {
+      timer.Stage("find peaks");
+      result.Regions = PeakSearch::GroupPeaks(*request.Spec, PeakSearch::FindPeaks(*request.Spec, request.Search), request.Search);
+      timer.Stage("fit regions");
+      if (!cancel)
+        result.Results = PeakSearch::AnalyseRegions(fContexts, *request.Spec, result.Regions, request.ChannelWidth, &result.Lines, &result.Peaks);
+    }
+    else
+    {
+      timer.Stage("fit");
+      result.Regions.push_back(request.Region);
+      result.Lines.push_back(request.Background);
+      result.Peaks.resize(1);
+      result.Results.push_back(AnalyseRegion(*fContexts[0], *request.Spec, request.Region, request.Background, request.ChannelWidth, &result.Peaks[0]));
+    }
+    timer.Stage("normalise");
+    for (std::vector<PeakResult> &region : result.Results)
+      Normalise(region, request.Norm);
+    result.Request = request;
+    return result;
+  }
+
+  std::vector<FitContext *> fContexts;
+  std::unique_ptr<LatestWorker<AnalysisRequest, AnalysisResult>> fWorker; // stopped before the contexts go
+};
+
+} // namespace SpectrumAnalysis
+
+#endif
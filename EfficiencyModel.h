@@ -0,0 +1,330 @@
+// Efficiency curve of the efficiency view as a compiled piecewise model: a parabola below
+// LineFrom, a hyperbola above LineTo and the straight line joining them in between, with the
+// parameters of the former FitEff1/FitEff2 formulas. Both pieces are fitted in closed form or
+// nearly so, a refit takes microseconds. Bootstrap replicas of the points, refitted on all
+// cores, give an energy-dependent band tabulated on a grid; Error(x) is half its width.
+#ifndef EfficiencyModel_h
+#define EfficiencyModel_h
+
+#include "SpectrumAnalysis.h"
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+
+namespace SpectrumAnalysis
+{
+
+struct EfficiencyRanges
+{
+  double ParabolaTo;       // the parabola is fitted to the points below, mirrored about it
+  double HyperbolaFrom;    // the hyperbola is fitted to the points from here up
+  double LineFrom, LineTo; // parabola below LineFrom, hyperbola above LineTo, line in between
+};
+
+class EfficiencyModel
+{
+public:
+  // p0*(x - p1)^2 + p2 and p0/(x + p1) + p2, joined by a*x + b
+  struct Curve
+  {
+    double Parabola[3] = {0, 0, 0}, Hyperbola[3] = {0, 0, 0};
+    double LineFrom = 0, LineTo = 0, LineA = 0, LineB = 0;
+
+    double EvalParabola(double x) const { return Parabola[0] * (x - Parabola[1]) * (x - Parabola[1]) + Parabola[2]; }
+    double EvalHyperbola(double x) const { return Hyperbola[0] / (x + Hyperbola[1]) + Hyperbola[2]; }
+    double Eval(double x) const
+    {
+      if (x < LineFrom)
+        return EvalParabola(x);
+      if (x <= LineTo)
+        return LineA * x + LineB;
+      return EvalHyperbola(x);
+    }
+  };
+
+  EfficiencyModel() {}
+
+  // Weighted by 1/err^2 (unit weights unless every err is positive). False when a piece had
+  // fewer than the distinct points it needs and fell back to the weighted mean.
+  bool Fit(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &err, const EfficiencyRanges &ranges)
+  {
+    fX = x;
+    fY = y;
+    fW.assign(x.size(), 1.);
+    if (std::all_of(err.begin(), err.end(), [](double e)
+                    { return e > 0; }) &&
+        err.size() == x.size())
+      for (size_t i = 0; i < x.size(); i++)
+        fW[i] = 1 / (err[i] * err[i]);
+    fRanges = ranges;
+    fLower.clear();
+    fUpper.clear();
+    std::vector<int> all(x.size());
+    for (size_t i = 0; i < all.size(); i++)
+      all[i] = i;
+    Workspace ws;
+    return FitCurve(all, ws, fCurve);
+  }
+
+  double Eval(double x) const { return fCurve.Eval(x); }
+  const Curve &GetCurve() const { return fCurve; }
+
+  // Refit nReplicas resamples of the points (drawn with replacement, reproducible for a given
+  // seed whatever the thread count) and tabulate the central 68% of the replica curves at
+  // nGrid points over [xmin, xmax]. Replicas with a degenerate piece are left out; returns
+  // the number used, 0 (and no band) once *cancel is set.
+  int Bootstrap(int nReplicas, double xmin, double xmax, int nGrid = 256, int nThreads = 0, uint64_t seed = 1, const std::atomic<bool> *cancel = nullptr)
+  {
+    fLower.clear();
+    fUpper.clear();
+    int n = fX.size();
+    if (n == 0 || nReplicas <= 0 || nGrid < 2 || !(xmax > xmin))
+      return 0;
+    if (nThreads <= 0)
+      nThreads = std::max(1u, std::thread::hardware_concurrency());
+    fGridMin = xmin;
+    fGridStep = (xmax - xmin) / (nGrid - 1);
+    std::vector<float> values((size_t)nReplicas * nGrid);
+    std::vector<char> used(nReplicas);
+    std::vector<Workspace> workspaces(nThreads);
+    ParallelFor(nReplicas, nThreads, [&](int worker, int r)
+                {
+                  if (cancel && *cancel)
+                  {
+                    used[r] = 0;
+                    return;
+                  }
+                  Workspace &ws = workspaces[worker];
+                  uint64_t state = seed * 0x9E3779B97F4A7C15ull + r;
+                  ws.Index.resize(n);
+                  for (int i = 0; i < n; i++)
+                    ws.Index[i] = std::min(n - 1, (int)((SplitMix(state) >> 11) * 0x1p-53 * n));
+                  std::sort(ws.Index.begin(), ws.Index.end());
+                  Curve curve;
+                  used[r] = FitCurve(ws.Index, ws, curve);
+                  if (used[r])
+                    for (int g = 0; g < nGrid; g++)
+                      values[(size_t)r * nGrid + g] = curve.Eval(fGridMin + g * fGridStep); });
+    int nUsed = std::count(used.begin(), used.end(), 1);
+    if (nUsed == 0 || (cancel && *cancel))
+      return 0;
+    fLower.resize(nGrid);
+    fUpper.resize(nGrid);
+    std::vector<std::vector<float>> columns(nThreads);
+    ParallelFor(nGrid, nThreads, [&](int worker, int g)
+                {
+                  std::vector<float> &column = columns[worker];
+                  column.clear();
+                  for (int r = 0; r < nReplicas; r++)
+                    if (used[r])
+                      column.push_back(values[(size_t)r * nGrid + g]);
+                  int lo = std::lround(0.15866 * (nUsed - 1)), hi = std::lround(0.84134 * (nUsed - 1));
+                  std::nth_element(column.begin(), column.begin() + lo, column.end());
+                  fLower[g] = column[lo];
+                  std::nth_element(column.begin(), column.begin() + hi, column.end());
+                  fUpper[g] = column[hi]; });
+    return nUsed;
+  }
+
+  // Central 68% band of the bootstrap, held at its edge values outside the grid; the curve
+  // itself and a zero error without a bootstrap
+  double Lower(double x) const { return fLower.empty() ? Eval(x) : Interpolate(fLower, x); }
+  double Upper(double x) const { return fUpper.empty() ? Eval(x) : Interpolate(fUpper, x); }
+  double Error(double x) const { return (Upper(x) - Lower(x)) / 2; }
+  bool HasBand() const { return !fLower.empty(); }
+
+  // Efficiency (and its error) at n positions at once
+  void Eval(const double *x, int n, double *eff, double *err = nullptr) const
+  {
+    for (int i = 0; i < n; i++)
+      eff[i] = fCurve.Eval(x[i]);
+    if (err)
+      for (int i = 0; i < n; i++)
+        err[i] = Error(x[i]);
+  }
+
+private:
+  struct Workspace
+  {
+    std::vector<int> Index;
+    std::vector<double> U, Y, W;
+  };
+
+  static uint64_t SplitMix(uint64_t &state)
+  {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  // Weighted straight line y = a*u + b; returns chi^2
+  static double WeightedLine(const std::vector<double> &u, const std::vector<double> &y, const std::vector<double> &w, double &a, double &b)
+  {
+    double sw = 0, mu = 0, my = 0;
+    for (size_t i = 0; i < u.size(); i++)
+    {
+      sw += w[i];
+      mu += w[i] * u[i];
+      my += w[i] * y[i];
+    }
+    mu /= sw;
+    my /= sw;
+    double suu = 0, suy = 0, syy = 0;
+    for (size_t i = 0; i < u.size(); i++)
+    {
+      double du = u[i] - mu, dy = y[i] - my;
+      suu += w[i] * du * du;
+      suy += w[i] * du * dy;
+      syy += w[i] * dy * dy;
+    }
+    a = suu > 0 ? suy / suu : 0;
+    b = my - a * mu;
+    return syy - a * suy;
+  }
+
+  // Selects the points of index (sorted, repeats allowed) passing keep into ws.U (as x), ws.Y,
+  // ws.W; returns the number of distinct points
+  template <class Keep>
+  int Select(const std::vector<int> &index, Workspace &ws, Keep keep) const
+  {
+    ws.U.clear();
+    ws.Y.clear();
+    ws.W.clear();
+    int nDistinct = 0;
+    for (size_t k = 0; k < index.size(); k++)
+    {
+      int i = index[k];
+      if (!keep(fX[i]))
+        continue;
+      nDistinct += k == 0 || index[k - 1] != i;
+      ws.U.push_back(fX[i]);
+      ws.Y.push_back(fY[i]);
+      ws.W.push_back(fW[i]);
+    }
+    return nDistinct;
+  }
+
+  bool FitCurve(const std::vector<int> &index, Workspace &ws, Curve &curve) const
+  {
+    double mean = 0, sw = 0;
+    for (int i : index)
+    {
+      mean += fW[i] * fY[i];
+      sw += fW[i];
+    }
+    mean = sw > 0 ? mean / sw : 0;
+    bool ok = true;
+
+    // Mirroring the points about ParabolaTo makes the best parabola symmetric about it, so
+    // only the curvature and the vertex height are fitted: a line in (x - ParabolaTo)^2
+    double m = fRanges.ParabolaTo;
+    curve.Parabola[0] = 0;
+    curve.Parabola[1] = m;
+    curve.Parabola[2] = mean;
+    if (Select(index, ws, [m](double x)
+               { return x < m; }) >= 2)
+    {
+      for (double &u : ws.U)
+        u = (u - m) * (u - m);
+      WeightedLine(ws.U, ws.Y, ws.W, curve.Parabola[0], curve.Parabola[2]);
+    }
+    else
+      ok = false;
+
+    // For a fixed pole the hyperbola is linear in 1/(x + p1): the pole, left of the points, is
+    // scanned on a log scale and refined by golden section on the profiled chi^2
+    double from = fRanges.HyperbolaFrom;
+    curve.Hyperbola[0] = 0;
+    curve.Hyperbola[1] = 0;
+    curve.Hyperbola[2] = mean;
+    if (Select(index, ws, [from](double x)
+               { return x >= from; }) >= 3)
+    {
+      std::vector<double> x = ws.U;
+      double xlo = *std::min_element(x.begin(), x.end()), xhi = *std::max_element(x.begin(), x.end());
+      double scale = std::max({xhi - xlo, std::fabs(xlo), 1e-9});
+      double p0, p2;
+      auto chi2 = [&](double logT)
+      {
+        double p1 = std::exp(logT) - xlo;
+        for (size_t i = 0; i < x.size(); i++)
+          ws.U[i] = 1 / (x[i] + p1);
+        return WeightedLine(ws.U, ws.Y, ws.W, p0, p2);
+      };
+      const int nScan = 80;
+      double logMin = std::log(scale * 1e-4), logStep = std::log(1e8) / nScan;
+      int best = 0;
+      double bestChi2 = chi2(logMin);
+      for (int k = 1; k <= nScan; k++)
+      {
+        double c = chi2(logMin + k * logStep);
+        if (c < bestChi2)
+        {
+          bestChi2 = c;
+          best = k;
+        }
+      }
+      const double golden = 0.6180339887498949;
+      double l = logMin + std::max(best - 1, 0) * logStep, r = logMin + std::min(best + 1, nScan) * logStep;
+      double t1 = r - golden * (r - l), t2 = l + golden * (r - l), c1 = chi2(t1), c2 = chi2(t2);
+      for (int it = 0; it < 40; it++)
+      {
+        if (c1 < c2)
+        {
+          r = t2;
+          t2 = t1;
+          c2 = c1;
+          t1 = r - golden * (r - l);
+          c1 = chi2(t1);
+        }
+        else
+        {
+          l = t1;
+          t1 = t2;
+          c1 = c2;
+          t2 = l + golden * (r - l);
+          c2 = chi2(t2);
+        }
+      }
+      double logT = (l + r) / 2;
+      chi2(logT);
+      curve.Hyperbola[0] = p0;
+      curve.Hyperbola[1] = std::exp(logT) - xlo;
+      curve.Hyperbola[2] = p2;
+    }
+    else
+      ok = false;
+
+    curve.LineFrom = fRanges.LineFrom;
+    curve.LineTo = fRanges.LineTo;
+    double yFrom = curve.EvalParabola(curve.LineFrom), yTo = curve.EvalHyperbola(curve.LineTo);
+    curve.LineA = curve.LineTo > curve.LineFrom ? (yTo - yFrom) / (curve.LineTo - curve.LineFrom) : 0;
+    curve.LineB = yTo - curve.LineA * curve.LineTo;
+    return ok;
+  }
+
+  double Interpolate(const std::vector<float> &table, double x) const
+  {
+    double t = (x - fGridMin) / fGridStep;
+    int last = table.size() - 1;
+    if (!(t > 0))
+      return table[0];
+    if (t >= last)
+      return table[last];
+    int i = (int)t;
+    return table[i] + (t - i) * (table[i + 1] - table[i]);
+  }
+
+  std::vector<double> fX, fY, fW;
+  EfficiencyRanges fRanges = {0, 0, 0, 0};
+  Curve fCurve;
+  double fGridMin = 0, fGridStep = 1;
+  std::vector<float> fLower, fUpper; // bootstrap band on the grid
+};
+
+} // namespace SpectrumAnalysis
+
+#endif
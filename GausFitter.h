@@ -0,0 +1,335 @@
+// Compiled fit of the one model spectrum.C uses, N Gaussians on a straight line:
+//   f(x) = p0 + p1*x + sum_k A_k*exp(-0.5*((x - mu_k)/sigma_k)^2),  p = {p0, p1, A_0, mu_0, sigma_0, ...}
+// Levenberg-Marquardt on contiguous bin arrays with the analytic Jacobian, either least squares
+// with the bin errors sqrt(max(y, 1)) used by the ROOT fit, or Poisson likelihood (Fisher scoring).
+// The peak count is a template parameter for the usual 1-4 peaks so the per-bin loops unroll.
+// Plain C++ (no ROOT) so the same code serves the GUI, the batch driver and the TF1 models.
+#ifndef GausFitter_h
+#define GausFitter_h
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <atomic>
+
+namespace GausFitter
+{
+
+enum ECost
+{
+  kChi2,    // sum (y - f)^2 / max(y, 1)
+  kPoisson, // 2 * sum (f - y + y*ln(y/f))
+};
+
+struct FitOptions
+{
+  ECost Cost = kChi2;
+  bool FitBackground = false; // p0, p1 fixed at their start values (side-band line) unless set
+  int MaxIterations = 200;
+  double Tolerance = 1e-9;      // relative change of the cost that ends the fit
+  double StepTolerance = 1e-8;  // or relative change of every free parameter
+  const std::atomic<bool> *Cancel = nullptr; // checked every iteration, ends the fit unconverged
+};
+
+struct FitResult
+{
+  std::vector<double> Params;
+  std::vector<double> Covariance; // nPar x nPar, rows and columns of fixed parameters are zero
+  double Cost = 0;
+  int NDF = 0, Iterations = 0;
+  bool Converged = false;
+
+  int GetNPeaks() const { return Params.size() < 2 ? 0 : (Params.size() - 2) / 3; }
+  double Cov(int i, int j) const { return Covariance[i * Params.size() + j]; }
+};
+
+// Model value at x
+inline double Eval(double x, const double *p, int nPeaks)
+{
+  double f = p[0] + p[1] * x;
+  for (int k = 0; k < nPeaks; k++)
+  {
+    double t = (x - p[3 + 3 * k]) / p[4 + 3 * k];
+    f += p[2 + 3 * k] * std::exp(-0.5 * t * t);
+  }
+  return f;
+}
+
+// Area of peak k over [xmin, xmax] in x units (erf closed form) and, from the covariance,
+// its standard error
+inline double Area(const FitResult &result, int k, double xmin, double xmax, double *error = nullptr)
+{
+  const int iA = 2 + 3 * k, iMu = iA + 1, iSigma = iA + 2;
+  const double a = result.Params[iA], mu = result.Params[iMu], sigma = std::fabs(result.Params[iSigma]);
+  const double u1 = (xmin - mu) / (std::sqrt(2.) * sigma), u2 = (xmax - mu) / (std::sqrt(2.) * sigma);
+  const double e1 = std::exp(-u1 * u1), e2 = std::exp(-u2 * u2), c = 1.2533141373155003 * (std::erf(u2) - std::erf(u1)); // sqrt(pi/2)
+  const double area = a * sigma * c;
+  if (error)
+  {
+    // d area / d(A, mu, sigma); the sign of sigma follows the fitted parameter
+    const double g[3] = {sigma * c, a * (e1 - e2), (a * c - a * std::sqrt(2.) * (u2 * e2 - u1 * e1)) * (result.Params[iSigma] < 0 ? -1 : 1)};
+    const int idx[3] = {iA, iMu, iSigma};
+    double var = 0;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        var += g[i] * g[j] * result.Cov(idx[i], idx[j]);
+    *error = std::sqrt(std::max(var, 0.));
+  }
+  return area;
+}
+
+namespace Detail
+{
+
+// In-place Cholesky factor of the m x m symmetric positive definite a (lower triangle used)
+inline bool Cholesky(double *a, int m)
+{
+  for (int j = 0; j < m; j++)
+  {
+    double d = a[j * m + j];
+    for (int k = 0; k < j; k++)
+      d -= a[j * m + k] * a[j * m + k];
+    if (!(d > 0))
+      return false;
+    d = std::sqrt(d);
+    a[j * m + j] = d;
+    for (int i = j + 1; i < m; i++)
+    {
+      double s = a[i * m + j];
+      for (int k = 0; k < j; k++)
+        s -= a[i * m + k] * a[j * m + k];
+      a[i * m + j] = s / d;
+    }
+  }
+  return true;
+}
+
+// Solves L L^T x = b in place
+inline void CholeskySolve(const double *l, int m, double *b)
+{
+  for (int i = 0; i < m; i++)
+  {
+    double s = b[i];
+    for (int k = 0; k < i; k++)
+      s -= l[i * m + k] * b[k];
+    b[i] = s / l[i * m + i];
+  }
+  for (int i = m - 1; i >= 0; i--)
+  {
+    double s = b[i];
+    for (int k = i + 1; k < m; k++)
+      s -= l[k * m + i] * b[k];
+    b[i] = s / l[i * m + i];
+  }
+}
+
+// One pass over the bins: cost at p, and the normal equations (J^T W J, J^T W r) over all
+// parameters, lower triangle only. The Jacobian is kept as one contiguous row of nBins per
+// parameter so the sums run down plain arrays; N > 0 fixes the peak count at compile time.
+// Returns infinity where the Poisson model goes non-positive under counts.
+template <int N>
+double Accumulate(const double *x, const double *y, int nBins, const double *p, int nPeaks, ECost cost, double *jac, double *f, double *w,
+                  double *alpha, double *beta)
+{
+  const int n = N > 0 ? N : nPeaks, nPar = 2 + 3 * n;
+  double *j0 = jac, *j1 = jac + nBins;
+  for (int i = 0; i < nBins; i++)
+  {
+    f[i] = p[0] + p[1] * x[i];
+    j0[i] = 1;
+    j1[i] = x[i];
+  }
+  for (int k = 0; k < n; k++)
+  {
+    const double a = p[2 + 3 * k], mu = p[3 + 3 * k], invSigma = 1 / p[4 + 3 * k];
+    double *jA = jac + (2 + 3 * k) * nBins, *jMu = jA + nBins, *jSigma = jMu + nBins;
+    for (int i = 0; i < nBins; i++)
+    {
+      const double t = (x[i] - mu) * invSigma, e = std::exp(-0.5 * t * t), ae = a * e;
+      f[i] += ae;
+      jA[i] = e;
+      jMu[i] = ae * t * invSigma;
+      jSigma[i] = jMu[i] * t;
+    }
+  }
+  // from here f holds the weighted residual w*(y - f)
+  double sum = 0;
+  for (int i = 0; i < nBins; i++)
+  {
+    const double r = y[i] - f[i];
+    if (cost == kChi2)
+    {
+      w[i] = 1 / std::max(y[i], 1.);
+      sum += r * r * w[i];
+    }
+    else if (f[i] > 0)
+    {
+      w[i] = 1 / f[i];
+      sum += 2 * (y[i] > 0 ? f[i] - y[i] + y[i] * std::log(y[i] / f[i]) : f[i]);
+    }
+    else if (y[i] > 0)
+      return std::numeric_limits<double>::infinity();
+    else
+      w[i] = 0;
+    f[i] = w[i] * r;
+  }
+  for (int a = 0; a < nPar; a++)
+  {
+    const double *ja = jac + a * nBins;
+    double s = 0;
+    for (int i = 0; i < nBins; i++)
+      s += ja[i] * f[i];
+    beta[a] = s;
+    for (int b = 0; b <= a; b++)
+    {
+      // four partial sums keep the multiply-adds independent
+      const double *jb = jac + b * nBins;
+      double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      int i = 0;
+      for (; i + 4 <= nBins; i += 4)
+      {
+        s0 += ja[i] * w[i] * jb[i];
+        s1 += ja[i + 1] * w[i + 1] * jb[i + 1];
+        s2 += ja[i + 2] * w[i + 2] * jb[i + 2];
+        s3 += ja[i + 3] * w[i + 3] * jb[i + 3];
+      }
+      for (; i < nBins; i++)
+        s0 += ja[i] * w[i] * jb[i];
+      alpha[a * nPar + b] = (s0 + s1) + (s2 + s3);
+    }
+  }
+  return sum;
+}
+
+// Normal equations restricted to the free parameters, both triangles filled
+inline void FreeBlock(const double *alpha, const double *beta, int nPar, const int *freeIdx, int m, double *freeAlpha, double *freeBeta)
+{
+  for (int a = 0; a < m; a++)
+  {
+    freeBeta[a] = beta[freeIdx[a]];
+    for (int b = 0; b <= a; b++)
+      freeAlpha[a * m + b] = freeAlpha[b * m + a] = alpha[freeIdx[a] * nPar + freeIdx[b]];
+  }
+}
+
+template <int N>
+FitResult Fit(const double *x, const double *y, int nBins, const std::vector<double> &start, const FitOptions &opt)
+{
+  FitResult result;
+  result.Params = start;
+  const int nPar = start.size(), nPeaks = (nPar - 2) / 3;
+  std::vector<int> freeIdx;
+  for (int i = opt.FitBackground ? 0 : 2; i < nPar; i++)
+    freeIdx.push_back(i);
+  const int m = freeIdx.size();
+  result.Covariance.assign(nPar * nPar, 0.);
+  result.NDF = nBins - m;
+  if (m == 0 || nBins < m)
+    return result;
+
+  // alpha/beta hold the normal equations at p, the trial versions are kept when a step is accepted
+  std::vector<double> jac(nPar * nBins), f(nBins), w(nBins), fullAlpha(nPar * nPar), fullBeta(nPar);
+  std::vector<double> p = start, trial(nPar), alpha(m * m), beta(m), trialAlpha(m * m), trialBeta(m), lhs(m * m), step(m);
+  double cost = Accumulate<N>(x, y, nBins, p.data(), nPeaks, opt.Cost, jac.data(), f.data(), w.data(), fullAlpha.data(), fullBeta.data());
+  if (!std::isfinite(cost))
+    return result;
+  FreeBlock(fullAlpha.data(), fullBeta.data(), nPar, freeIdx.data(), m, alpha.data(), beta.data());
+  double lambda = 1e-3;
+  int iter = 0;
+  bool converged = false, stuck = false;
+  for (; iter < opt.MaxIterations && !converged && !stuck && !(opt.Cancel && *opt.Cancel); iter++)
+  {
+    bool accepted = false;
+    while (!accepted)
+    {
+      // Marquardt damping scales the diagonal, so badly scaled parameters (A vs mu) are fine
+      for (int a = 0; a < m * m; a++)
+        lhs[a] = alpha[a];
+      for (int a = 0; a < m; a++)
+        lhs[a * m + a] = alpha[a * m + a] > 0 ? alpha[a * m + a] * (1 + lambda) : lambda;
+      std::copy(beta.begin(), beta.end(), step.begin());
+      double trialCost = std::numeric_limits<double>::infinity();
+      if (Cholesky(lhs.data(), m))
+      {
+        CholeskySolve(lhs.data(), m, step.data());
+        trial = p;
+        for (int a = 0; a < m; a++)
+          trial[freeIdx[a]] += step[a];
+        bool valid = true;
+        for (int k = 0; k < nPeaks; k++)
+          valid = valid && std::fabs(trial[4 + 3 * k]) > 1e-12 * (1 + std::fabs(trial[3 + 3 * k]));
+        if (valid)
+          trialCost = Accumulate<N>(x, y, nBins, trial.data(), nPeaks, opt.Cost, jac.data(), f.data(), w.data(), fullAlpha.data(), fullBeta.data());
+        if (std::isfinite(trialCost))
+          FreeBlock(fullAlpha.data(), fullBeta.data(), nPar, freeIdx.data(), m, trialAlpha.data(), trialBeta.data());
+      }
+      if (trialCost <= cost)
+      {
+        converged = cost - trialCost <= opt.Tolerance * (cost + opt.Tolerance);
+        bool small = true;
+        for (int a = 0; a < m; a++)
+          small = small && std::fabs(step[a]) <= opt.StepTolerance * (std::fabs(p[freeIdx[a]]) + opt.StepTolerance);
+        converged = converged || small;
+        p.swap(trial);
+        alpha.swap(trialAlpha);
+        beta.swap(trialBeta);
+        cost = trialCost;
+        lambda = std::max(lambda * 0.1, 1e-12);
+        accepted = true;
+      }
+      else
+      {
+        lambda *= 10;
+        // no step lowers the cost even along the gradient: give up, the fit is not converged
+        if (lambda > 1e10)
+        {
+          stuck = true;
+          break;
+        }
+      }
+    }
+  }
+
+  result.Params = p;
+  result.Cost = cost;
+  result.Iterations = iter;
+  result.Converged = converged;
+  // covariance = (J^T W J)^-1, as Minuit reports it for a chi2 (UP = 1) or Poisson likelihood fit
+  std::copy(alpha.begin(), alpha.end(), lhs.begin());
+  if (Cholesky(lhs.data(), m))
+    for (int b = 0; b < m; b++)
+    {
+      std::fill(step.begin(), step.end(), 0.);
+      step[b] = 1;
+      CholeskySolve(lhs.data(), m, step.data());
+      for (int a = 0; a < m; a++)
+        result.Covariance[freeIdx[a] * nPar + freeIdx[b]] = step[a];
+    }
+  return result;
+}
+
+} // namespace Detail
+
+// Fit of nBins points (x, y) from start = {p0, p1, A_0, mu_0, sigma_0, ...}; sigma may come out
+// negative, only its magnitude is meaningful
+inline FitResult Fit(const double *x, const double *y, int nBins, const std::vector<double> &start, const FitOptions &opt = FitOptions())
+{
+  switch ((int)(start.size() - 2) / 3)
+  {
+  case 1:
+    return Detail::Fit<1>(x, y, nBins, start, opt);
+  case 2:
+    return Detail::Fit<2>(x, y, nBins, start, opt);
+  case 3:
+    return Detail::Fit<3>(x, y, nBins, start, opt);
+  case 4:
+    return Detail::Fit<4>(x, y, nBins, start, opt);
+  default:
+    return Detail::Fit<0>(x, y, nBins, start, opt);
+  }
+}
+
+} // namespace GausFitter
+
+#endif
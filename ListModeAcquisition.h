@@ -0,0 +1,395 @@
+// Live list-mode acquisition for spectrum.C: timestamped events are read from a growing
+// file, a pipe, a local (AF_UNIX) socket or a TRandom-based generator standing in for the
+// DAQ, pass through lock-free single-producer/single-consumer ring buffers and are binned by
+// consumer threads into partial histograms that the GUI merges on a timer.
+//
+// Wire format (file, pipe, socket): consecutive little-endian Event records of 16 bytes,
+// uint64 time in ns followed by uint32 channel and uint32 flags (ignored).
+#ifndef ListModeAcquisition_h
+#define ListModeAcquisition_h
+
+#include <TRandom3.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace ListMode
+{
+
+struct Event
+{
+  uint64_t Time; // ns
+  uint32_t Channel;
+  uint32_t Flags;
+};
+
+// Bounded single-producer/single-consumer queue; capacity is rounded up to a power of two
+template <class T>
+class RingBuffer
+{
+public:
+  explicit RingBuffer(size_t capacity)
+  {
+    size_t n = 1;
+    while (n < capacity)
+      n <<= 1;
+    fBuffer.resize(n);
+    fMask = n - 1;
+  }
+
+  // Copies up to n items, returns how many fitted
+  size_t Push(const T *items, size_t n)
+  {
+    size_t head = fHead.load(std::memory_order_relaxed);
+    size_t tail = fTail.load(std::memory_order_acquire);
+    n = std::min(n, fBuffer.size() - (head - tail));
+    for (size_t i = 0; i < n; i++)
+      fBuffer[(head + i) & fMask] = items[i];
+    fHead.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  // Moves up to n items out, returns how many were available
+  size_t Pop(T *items, size_t n)
+  {
+    size_t tail = fTail.load(std::memory_order_relaxed);
+    size_t head = fHead.load(std::memory_order_acquire);
+    n = std::min(n, head - tail);
+    for (size_t i = 0; i < n; i++)
+      items[i] = fBuffer[(tail + i) & fMask];
+    fTail.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  bool Empty() const { return fHead.load(std::memory_order_acquire) == fTail.load(std::memory_order_acquire); }
+
+private:
+  std::vector<T> fBuffer;
+  size_t fMask;
+  alignas(64) std::atomic<size_t> fHead{0};
+  alignas(64) std::atomic<size_t> fTail{0};
+};
+
+class EventSource
+{
+public:
+  virtual ~EventSource() {}
+  // Up to n events; 0 when nothing is available right now
+  virtual size_t Read(Event *events, size_t n) = 0;
+  // No more events will ever come
+  virtual bool IsFinished() const = 0;
+  // Called from another thread on Stop(): makes a Read in progress return soon
+  virtual void Interrupt() {}
+};
+
+// File being appended to (followed like "tail -f"), named pipe or local socket. Nothing
+// blocks for longer than kPollTimeout: a pipe is opened without waiting for its writer and
+// Read waits for data with poll(), so the producer sees Stop() in time.
+class StreamSource : public EventSource
+{
+public:
+  static const int kPollTimeout = 50; // ms
+
+  explicit StreamSource(const char *path) : fFd(-1), fSocket(false), fFollow(false), fFinished(false), fPending(0)
+  {
+    struct stat st;
+    if (stat(path, &st) != 0)
+      return;
+    if (S_ISSOCK(st.st_mode))
+    {
+      fFd = socket(AF_UNIX, SOCK_STREAM, 0);
+      fSocket = true;
+      sockaddr_un addr;
+      std::memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+      if (fFd >= 0 && connect(fFd, (sockaddr *)&addr, sizeof(addr)) != 0)
+      {
+        close(fFd);
+        fFd = -1;
+      }
+    }
+    else
+    {
+      fFd = open(path, O_RDONLY | O_NONBLOCK);
+      fFollow = S_ISREG(st.st_mode);
+    }
+  }
+  ~StreamSource()
+  {
+    if (fFd >= 0)
+      close(fFd);
+  }
+
+  bool IsOpen() const { return fFd >= 0; }
+  bool IsFinished() const override { return fFinished || fFd < 0; }
+
+  // A blocked read() on a socket returns 0 once it is shut down; pipes and files are only
+  // read after poll() said so
+  void Interrupt() override
+  {
+    if (fSocket && fFd >= 0)
+      shutdown(fFd, SHUT_RDWR);
+  }
+
+  size_t Read(Event *events, size_t n) override
+  {
+    if (IsFinished())
+      return 0;
+    // a pipe without a writer yet is not readable, one whose writer left is (POLLHUP)
+    pollfd pfd = {fFd, POLLIN, 0};
+    if (poll(&pfd, 1, kPollTimeout) <= 0)
+      return 0;
+    char *buffer = (char *)events;
+    std::memcpy(buffer, fPartial, fPending);
+    ssize_t got = read(fFd, buffer + fPending, n * sizeof(Event) - fPending);
+    if (got < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        fFinished = true;
+      return 0;
+    }
+    if (got == 0)
+    {
+      // end of a growing file just means no new data yet
+      if (!fFollow)
+        fFinished = true;
+      return 0;
+    }
+    size_t bytes = fPending + got, nEvents = bytes / sizeof(Event);
+    fPending = bytes - nEvents * sizeof(Event);
+    std::memcpy(fPartial, buffer + nEvents * sizeof(Event), fPending);
+    return nEvents;
+  }
+
+private:
+  int fFd;
+  bool fSocket, fFollow, fFinished;
+  size_t fPending;
+  char fPartial[sizeof(Event)];
+};
+
+// Stand-in for the DAQ: Gaussian lines on an exponential continuum at a given event rate
+class GeneratorSource : public EventSource
+{
+public:
+  GeneratorSource(double rate, int nChannels = 16384, unsigned seed = 4357)
+      : fRandom(seed), fRate(rate), fNChannels(nChannels), fTime(0), fStart(std::chrono::steady_clock::now())
+  {
+    double lines[][3] = {{0.1, 2.5, 0.20}, {0.23, 3.0, 0.12}, {0.24, 3.0, 0.08}, {0.41, 4.0, 0.10}, {0.72, 5.0, 0.05}};
+    for (auto &line : lines)
+    {
+      fLineMean.push_back(line[0] * nChannels);
+      fLineSigma.push_back(line[1]);
+      fLineFraction.push_back(line[2]);
+    }
+  }
+
+  bool IsFinished() const override { return false; }
+
+  size_t Read(Event *events, size_t n) override
+  {
+    // keep pace with the wall clock when a rate is given, otherwise run flat out
+    if (fRate > 0)
+    {
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
+      double due = elapsed * fRate - fTime * 1e-9 * fRate;
+      if (due < 1)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        return 0;
+      }
+      n = std::min(n, (size_t)due);
+    }
+    double meanInterval = 1e9 / (fRate > 0 ? fRate : 1e7);
+    for (size_t i = 0; i < n; i++)
+    {
+      fTime += fRandom.Exp(meanInterval);
+      double r = fRandom.Rndm(), x = -1;
+      for (size_t l = 0; l < fLineMean.size() && x < 0; l++)
+      {
+        if (r < fLineFraction[l])
+          x = fRandom.Gaus(fLineMean[l], fLineSigma[l]);
+        r -= fLineFraction[l];
+      }
+      if (x < 0)
+        x = fRandom.Exp(fNChannels / 4.);
+      events[i].Time = (uint64_t)fTime;
+      events[i].Channel = std::min((uint32_t)std::max(x, 0.), (uint32_t)fNChannels - 1);
+      events[i].Flags = 0;
+    }
+    return n;
+  }
+
+private:
+  TRandom3 fRandom;
+  double fRate;
+  int fNChannels;
+  double fTime;
+  std::chrono::steady_clock::time_point fStart;
+  std::vector<double> fLineMean, fLineSigma, fLineFraction;
+};
+
+// One producer thread reads the source and deals batches round-robin to nConsumers rings;
+// each consumer thread owns one ring and one partial histogram. Nothing is dropped: a full
+// ring makes the producer wait, leaving data in the file, pipe or socket buffer.
+class Acquisition
+{
+public:
+  static const size_t kBatch = 4096;
+
+  Acquisition(EventSource *source, int nConsumers = 2, int maxChannels = 1 << 16, size_t ringCapacity = 1 << 20)
+      : fSource(source), fMaxChannels(maxChannels), fStop(false), fProducerDone(false), fEvents(0)
+  {
+    for (int i = 0; i < nConsumers; i++)
+      fConsumers.emplace_back(new Consumer(ringCapacity, maxChannels));
+    for (int i = 0; i < nConsumers; i++)
+      fConsumers[i]->Thread = std::thread(&Acquisition::Consume, this, i);
+    fProducer = std::thread(&Acquisition::Produce, this);
+  }
+  ~Acquisition() { Stop(); }
+
+  void Stop()
+  {
+    fStop = true;
+    fSource->Interrupt();
+    if (fProducer.joinable())
+      fProducer.join();
+    for (auto &c : fConsumers)
+      if (c->Thread.joinable())
+        c->Thread.join();
+  }
+
+  bool IsFinished() const
+  {
+    if (!fProducerDone)
+      return false;
+    for (auto &c : fConsumers)
+      if (!c->Ring.Empty())
+        return false;
+    return true;
+  }
+
+  // Adds everything binned since the previous call to counts (grown to the highest channel
+  // seen so far) and widens [firstTime, lastTime] in ns (start with firstTime = UINT64_MAX,
+  // lastTime = 0); returns the number of new events
+  uint64_t Merge(std::vector<double> &counts, uint64_t &firstTime, uint64_t &lastTime)
+  {
+    uint64_t nEvents = 0;
+    for (auto &c : fConsumers)
+    {
+      std::lock_guard<std::mutex> lock(c->Mutex);
+      if (c->NEvents == 0)
+        continue;
+      if (counts.size() < c->MaxChannel + 1)
+        counts.resize(c->MaxChannel + 1, 0.);
+      for (uint32_t ch = c->MinChannel; ch <= c->MaxChannel; ch++)
+      {
+        counts[ch] += c->Counts[ch];
+        c->Counts[ch] = 0;
+      }
+      firstTime = std::min(firstTime, c->FirstTime);
+      lastTime = std::max(lastTime, c->LastTime);
+      nEvents += c->NEvents;
+      c->NEvents = 0;
+      c->MinChannel = fMaxChannels;
+      c->MaxChannel = 0;
+    }
+    return nEvents;
+  }
+
+  uint64_t GetNEvents() const { return fEvents; }
+
+private:
+  struct Consumer
+  {
+    Consumer(size_t capacity, int maxChannels) : Ring(capacity), Counts(maxChannels, 0), NEvents(0), MinChannel(maxChannels), MaxChannel(0) {}
+    RingBuffer<Event> Ring;
+    std::thread Thread;
+    std::mutex Mutex; // guards the partial histogram against Merge()
+    std::vector<uint32_t> Counts;
+    uint64_t NEvents, FirstTime, LastTime;
+    uint32_t MinChannel, MaxChannel;
+  };
+
+  void Produce()
+  {
+    std::vector<Event> batch(kBatch);
+    size_t next = 0;
+    while (!fStop && !fSource->IsFinished())
+    {
+      size_t n = fSource->Read(batch.data(), kBatch);
+      if (n == 0)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        continue;
+      }
+      RingBuffer<Event> &ring = fConsumers[next]->Ring;
+      next = (next + 1) % fConsumers.size();
+      for (size_t done = 0; done < n && !fStop;)
+      {
+        size_t pushed = ring.Push(batch.data() + done, n - done);
+        done += pushed;
+        if (!pushed)
+          std::this_thread::yield();
+      }
+      fEvents += n;
+    }
+    fProducerDone = true;
+  }
+
+  void Consume(int id)
+  {
+    Consumer &c = *fConsumers[id];
+    std::vector<Event> batch(kBatch);
+    while (true)
+    {
+      size_t n = c.Ring.Pop(batch.data(), kBatch);
+      if (n == 0)
+      {
+        if (fStop || (fProducerDone && c.Ring.Empty()))
+          break;
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(c.Mutex);
+      if (c.NEvents == 0)
+        c.FirstTime = c.LastTime = batch[0].Time;
+      for (size_t i = 0; i < n; i++)
+      {
+        uint32_t ch = std::min(batch[i].Channel, (uint32_t)fMaxChannels - 1);
+        c.Counts[ch]++;
+        c.MinChannel = std::min(c.MinChannel, ch);
+        c.MaxChannel = std::max(c.MaxChannel, ch);
+        c.FirstTime = std::min(c.FirstTime, batch[i].Time);
+        c.LastTime = std::max(c.LastTime, batch[i].Time);
+      }
+      c.NEvents += n;
+    }
+  }
+
+  std::unique_ptr<EventSource> fSource;
+  uint32_t fMaxChannels;
+  std::vector<std::unique_ptr<Consumer>> fConsumers;
+  std::thread fProducer;
+  std::atomic<bool> fStop, fProducerDone;
+  std::atomic<uint64_t> fEvents;
+};
+
+} // namespace ListMode
+
+#endif
@@ -0,0 +1,178 @@
+// Automatic whole-spectrum peak search: SNIP continuum plus a smoothed second-derivative
+// detector over contiguous arrays, grouping of close candidates into multiplet regions with
+// their own side-bands, and concurrent fitting of all regions.
+#ifndef PeakSearch_h
+#define PeakSearch_h
+
+#include "SpectrumAnalysis.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace PeakSearch
+{
+
+struct PeakCandidate
+{
+  double Position, Sigma, Height, Significance; // Position and Sigma in axis units
+};
+
+struct SearchOptions
+{
+  double Sigma = 2;         // expected peak sigma, bins
+  double Threshold = 4;     // minimum detector significance
+  double MinHeight = 5;     // minimum height above the SNIP continuum, counts
+  double GroupDistance = 3; // candidates closer than this many (sigma1 + sigma2) share a region
+};
+
+// SNIP continuum (Ryan et al.) on the LLS-compressed spectrum, window growing to nIterations bins
+inline std::vector<double> SnipBackground(const std::vector<double> &y, int nIterations)
+{
+  int n = y.size();
+  std::vector<double> v(n), w(n);
+  for (int i = 0; i < n; i++)
+    v[i] = std::log(std::log(std::sqrt(std::max(y[i], 0.) + 1) + 1) + 1);
+  for (int p = 1; p <= nIterations && 2 * p < n; p++)
+  {
+    const double *in = v.data();
+    double *out = w.data();
+    for (int i = 0; i < p; i++)
+      out[i] = in[i];
+    for (int i = p; i < n - p; i++)
+      out[i] = std::min(in[i], 0.5 * (in[i - p] + in[i + p]));
+    for (int i = n - p; i < n; i++)
+      out[i] = in[i];
+    v.swap(w);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    double t = std::exp(std::exp(v[i]) - 1) - 1;
+    v[i] = t * t - 1;
+  }
+  return v;
+}
+
+// Candidates where the negative second derivative of a Gaussian (sigma in bins) responds
+// above threshold; the width follows from the response's zero crossings, which sit at
+// +-sqrt(sigma_peak^2 + sigma_kernel^2)
+inline std::vector<PeakCandidate> FindPeaks(const SpectrumAnalysis::Spectrum &spec, const SearchOptions &opt = SearchOptions())
+{
+  std::vector<PeakCandidate> peaks;
+  const std::vector<double> &y = spec.Counts;
+  int n = y.size();
+  int half = std::max(2, (int)std::ceil(3 * opt.Sigma));
+  if (n < 2 * half + 3)
+    return peaks;
+
+  std::vector<double> kernel(2 * half + 1), kernel2(2 * half + 1);
+  double mean = 0;
+  for (int j = -half; j <= half; j++)
+  {
+    double t = j / opt.Sigma;
+    kernel[j + half] = (1 - t * t) * std::exp(-0.5 * t * t);
+    mean += kernel[j + half];
+  }
+  mean /= kernel.size();
+  for (int j = 0; j < (int)kernel.size(); j++)
+  {
+    kernel[j] -= mean; // zero sum: no response to a linear continuum
+    kernel2[j] = kernel[j] * kernel[j];
+  }
+
+  // tap-outer loops keep the inner loop a plain multiply-add over contiguous bins
+  std::vector<double> variance(y.size());
+  for (int i = 0; i < n; i++)
+    variance[i] = std::max(y[i], 1.);
+  int m = n - 2 * half;
+  std::vector<double> response(m, 0.), noise(m, 0.);
+  for (int j = 0; j < (int)kernel.size(); j++)
+  {
+    const double k = kernel[j], k2 = kernel2[j];
+    const double *yj = y.data() + j, *vj = variance.data() + j;
+    double *r = response.data(), *s = noise.data();
+    for (int i = 0; i < m; i++)
+    {
+      r[i] += k * yj[i];
+      s[i] += k2 * vj[i];
+    }
+  }
+
+  std::vector<double> continuum = SnipBackground(y, (int)std::ceil(4 * opt.Sigma));
+  double w = spec.GetBinWidth();
+  for (int i = 1; i < m - 1; i++)
+  {
+    if (response[i] <= 0 || response[i] < response[i - 1] || response[i] <= response[i + 1])
+      continue;
+    double significance = response[i] / std::sqrt(noise[i]);
+    int bin = i + half;
+    double height = y[bin] - continuum[bin];
+    if (significance < opt.Threshold || height < opt.MinHeight)
+      continue;
+    int left = i, right = i;
+    while (left > 0 && response[left] > 0)
+      left--;
+    while (right < m - 1 && response[right] > 0)
+      right++;
+    double xl = response[left] <= 0 ? left + response[left] / (response[left] - response[left + 1]) : left;
+    double xr = response[right] <= 0 ? right - response[right] / (response[right] - response[right - 1]) : right;
+    double halfWidth = 0.5 * (xr - xl);
+    double sigma = std::sqrt(std::max(halfWidth * halfWidth - opt.Sigma * opt.Sigma, 0.25));
+    // parabola through the three top responses for a sub-bin position
+    double denom = response[i - 1] - 2 * response[i] + response[i + 1];
+    double shift = denom != 0 ? 0.5 * (response[i - 1] - response[i + 1]) / denom : 0;
+    peaks.push_back({spec.GetBinCenter(bin) + shift * w, sigma * w, height, significance});
+  }
+  return peaks;
+}
+
+// Neighbouring candidates closer than GroupDistance*(sigma1 + sigma2) form one region spanning
+// +-3 sigma around its outer peaks; side-bands of about two sigma (at least 3 bins)
+inline std::vector<SpectrumAnalysis::RegionDef> GroupPeaks(const SpectrumAnalysis::Spectrum &spec, std::vector<PeakCandidate> peaks,
+                                                           const SearchOptions &opt = SearchOptions())
+{
+  std::vector<SpectrumAnalysis::RegionDef> regions;
+  std::sort(peaks.begin(), peaks.end(), [](const PeakCandidate &l, const PeakCandidate &r)
+            { return l.Position < r.Position; });
+  double w = spec.GetBinWidth();
+  for (size_t i = 0; i < peaks.size();)
+  {
+    size_t last = i;
+    double maxSigma = peaks[i].Sigma;
+    while (last + 1 < peaks.size() && peaks[last + 1].Position - peaks[last].Position < opt.GroupDistance * (peaks[last].Sigma + peaks[last + 1].Sigma))
+    {
+      last++;
+      maxSigma = std::max(maxSigma, peaks[last].Sigma);
+    }
+    SpectrumAnalysis::RegionDef region;
+    region.Min = std::max(peaks[i].Position - 3 * peaks[i].Sigma, spec.Xmin);
+    region.Max = std::min(peaks[last].Position + 3 * peaks[last].Sigma, spec.Xmax - w);
+    region.NPeaks = last - i + 1;
+    region.BorderBins = std::max(3, (int)std::ceil(2 * maxSigma / w));
+    for (size_t k = i; k <= last; k++)
+      region.Seeds.push_back({peaks[k].Height, peaks[k].Position, peaks[k].Sigma});
+    regions.push_back(region);
+    i = last + 1;
+  }
+  return regions;
+}
+
+// All regions fitted concurrently, one FitContext per worker; results[i] belongs to regions[i]
+inline std::vector<std::vector<SpectrumAnalysis::PeakResult>> AnalyseRegions(std::vector<SpectrumAnalysis::FitContext *> &contexts, const SpectrumAnalysis::Spectrum &spec,
+                                                                             const std::vector<SpectrumAnalysis::RegionDef> &regions, double channelWidth,
+                                                                             std::vector<SpectrumAnalysis::LinearBackground> *bkgOut = nullptr,
+                                                                             std::vector<std::vector<SpectrumAnalysis::GausPeak>> *peaksOut = nullptr)
+{
+  std::vector<std::vector<SpectrumAnalysis::PeakResult>> results(regions.size());
+  if (bkgOut)
+    bkgOut->resize(regions.size());
+  if (peaksOut)
+    peaksOut->resize(regions.size());
+  SpectrumAnalysis::ParallelFor(regions.size(), contexts.size(), [&](int worker, int i)
+                                { results[i] = SpectrumAnalysis::AnalyseRegion(*contexts[worker], spec, regions[i], channelWidth,
+                                                                               bkgOut ? &(*bkgOut)[i] : nullptr, peaksOut ? &(*peaksOut)[i] : nullptr); });
+  return results;
+}
+
+} // namespace PeakSearch
+
+#endif
@@ -0,0 +1,451 @@
+// GUI-free analysis steps used by spectrum.C and spectrumBatch.C:
+// calibration remap, rebin, side-band linear background, single/multi-Gaussian fit
+// (GausFitter.h, with the TF1/Minuit fit kept as reference), live-time and
+// efficiency/N_gamma normalisation.
+#ifndef SpectrumAnalysis_h
+#define SpectrumAnalysis_h
+
+#include <TF1.h>
+#include <TH1.h>
+#include <TFitResult.h>
+#include <TFitResultPtr.h>
+#include <TMath.h>
+#include <TString.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include "SpectrumIO.h"
+#include "GausFitter.h"
+
+namespace SpectrumAnalysis
+{
+
+// Uniformly binned spectrum, bin i (0-based) covers [Xmin + i*w, Xmin + (i+1)*w)
+struct Spectrum
+{
+  std::vector<double> Counts;
+  double Xmin = 0, Xmax = 0;
+
+  int GetNbins() const { return Counts.size(); }
+  double GetBinWidth() const { return Counts.empty() ? 0 : (Xmax - Xmin) / Counts.size(); }
+  double GetBinCenter(int i) const { return Xmin + (i + 0.5) * GetBinWidth(); }
+  int FindBin(double x) const { return (int)std::floor((x - Xmin) / GetBinWidth()); }
+};
+
+struct GausPeak
+{
+  double Amplitude, Mean, Sigma;
+};
+
+struct RegionDef
+{
+  double Min, Max;
+  int NPeaks;
+  int BorderBins;
+  std::vector<GausPeak> Seeds; // optional start values, e.g. from the peak search
+};
+
+struct LinearBackground
+{
+  double p0 = 0, p1 = 0; // y = p1*x + p0
+  double Eval(double x) const { return p0 + p1 * x; }
+};
+
+struct PeakResult
+{
+  double Position, FWHM, Integral, IntegralError;
+};
+
+// Two-column text (x, counts) as written by the acquisition software, through the sidecar cache
+inline bool LoadSpectrum(const char *fileName, Spectrum &spec)
+{
+  return SpectrumIO::LoadSpectrum(fileName, spec.Counts, spec.Xmin, spec.Xmax);
+}
+
+// Three-column text (x, y, yerr): calibration and efficiency files
+inline bool LoadTable(const char *fileName, std::vector<double> &x, std::vector<double> &y, std::vector<double> &yerr)
+{
+  std::vector<double> values;
+  if (!SpectrumIO::LoadTable(fileName, 3, values))
+    return false;
+  size_t n = values.size() / 3;
+  x.resize(n);
+  y.resize(n);
+  yerr.resize(n);
+  for (size_t i = 0; i < n; i++)
+  {
+    x[i] = values[3 * i];
+    y[i] = values[3 * i + 1];
+    yerr[i] = values[3 * i + 2];
+  }
+  return n > 0;
+}
+
+// Unweighted straight-line least squares, same result as a "pol1" fit of a TGraph
+inline LinearBackground FitLine(const std::vector<double> &x, const std::vector<double> &y)
+{
+  LinearBackground line;
+  int n = x.size();
+  if (n == 0)
+    return line;
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (int i = 0; i < n; i++)
+  {
+    sx += x[i];
+    sy += y[i];
+    sxx += x[i] * x[i];
+    sxy += x[i] * y[i];
+  }
+  double det = n * sxx - sx * sx;
+  if (n < 2 || det == 0)
+  {
+    line.p0 = sy / n;
+    return line;
+  }
+  line.p1 = (n * sxy - sx * sy) / det;
+  line.p0 = (sy - line.p1 * sx) / n;
+  return line;
+}
+
+// Energy calibration E = a*channel + b from (channel, energy) points
+inline LinearBackground FitCalibration(const std::vector<double> &channel, const std::vector<double> &energy)
+{
+  return FitLine(channel, energy);
+}
+
+// Move the axis to x' = a*x + b, contents unchanged
+inline Spectrum ApplyCalibration(const Spectrum &spec, double a, double b)
+{
+  Spectrum out;
+  out.Counts = spec.Counts;
+  out.Xmin = spec.Xmin * a + b;
+  out.Xmax = spec.Xmax * a + b;
+  return out;
+}
+
+// Combine groups of nCombined bins, contents are averaged as in the "Combine channels" entry
+inline Spectrum Rebin(const Spectrum &spec, int nCombined)
+{
+  if (nCombined <= 1)
+    return spec;
+  Spectrum out;
+  int nBinsNew = spec.GetNbins() / nCombined;
+  out.Counts.assign(nBinsNew, 0.);
+  for (int i = 0; i < nBinsNew * nCombined; i++)
+    out.Counts[i / nCombined] += spec.Counts[i];
+  for (int i = 0; i < nBinsNew; i++)
+    out.Counts[i] /= nCombined;
+  out.Xmin = spec.Xmin;
+  out.Xmax = spec.Xmin + nBinsNew * nCombined * spec.GetBinWidth();
+  return out;
+}
+
+// Straight line through borderBins bins left of minPos and right of maxPos (both edge bins included)
+inline LinearBackground FitSideBands(const Spectrum &spec, double minPos, double maxPos, int borderBins)
+{
+  std::vector<double> x, y;
+  int binMin = spec.FindBin(minPos), binMax = spec.FindBin(maxPos);
+  for (int i = 0; i < borderBins; i++)
+  {
+    if (binMin - i >= 0 && binMin - i < spec.GetNbins())
+    {
+      x.push_back(spec.GetBinCenter(binMin - i));
+      y.push_back(spec.Counts[binMin - i]);
+    }
+    if (binMax + i >= 0 && binMax + i < spec.GetNbins())
+    {
+      x.push_back(spec.GetBinCenter(binMax + i));
+      y.push_back(spec.Counts[binMax + i]);
+    }
+  }
+  return FitLine(x, y);
+}
+
+// Line plus nPeaks Gaussians as a compiled TF1 (no formula to parse), parameters as in
+// GausFitter: p0, p1, then amplitude, mean, sigma of each peak. Kept out of the global list.
+inline TF1 *NewPeakModel(const char *name, int nPeaks, double xmin = 0, double xmax = 1)
+{
+  return new TF1(name, [nPeaks](double *x, double *p)
+                 { return GausFitter::Eval(x[0], p, nPeaks); },
+                 xmin, xmax, 2 + 3 * nPeaks, 1, TF1::EAddToList::kNo);
+}
+
+// Owns every ROOT object one fitting thread needs. Names carry the context id and
+// functions stay out of the global list, so several contexts can fit concurrently
+// (after ROOT::EnableThreadSafety()).
+class FitContext
+{
+public:
+  enum EFitter
+  {
+    kCompiled, // GausFitter, analytic derivatives
+    kMinuit,   // TH1::Fit of the same model, the reference for cross-checks
+  };
+
+  explicit FitContext(int id = 0) : fId(id), fFitter(kCompiled), fCancel(nullptr), fHist(nullptr) {}
+  ~FitContext()
+  {
+    delete fHist;
+    for (auto &f : fModels)
+      delete f.second;
+  }
+
+  void SetFitter(EFitter fitter) { fFitter = fitter; }
+  EFitter GetFitter() const { return fFitter; }
+  // Compiled fits stop early (unconverged) once *cancel is set; Minuit fits run to the end
+  void SetCancelFlag(const std::atomic<bool> *cancel) { fCancel = cancel; }
+
+  // Gaussians on top of the fixed background line in the region [minPos, maxPos], started
+  // from seeds when one per peak is given. Both fitters minimise the same chi2 (bin errors
+  // sqrt(max(counts, 1))); resultOut gets the parameters and their covariance.
+  std::vector<GausPeak> FitPeaks(const Spectrum &spec, const LinearBackground &bkg, double minPos, double maxPos, int nPeaks,
+                                 const std::vector<GausPeak> &seeds = std::vector<GausPeak>(), GausFitter::FitResult *resultOut = nullptr)
+  {
+    std::vector<GausPeak> peaks;
+    // bins with their centre inside the range, as TH1::Fit(..., "R") takes them
+    int binMin = std::max(spec.FindBin(minPos), 0), binMax = std::min(spec.FindBin(maxPos), spec.GetNbins() - 1);
+    if (binMin < spec.GetNbins() && spec.GetBinCenter(binMin) < minPos)
+      binMin++;
+    if (binMax >= 0 && spec.GetBinCenter(binMax) > maxPos)
+      binMax--;
+    if (nPeaks < 1 || binMax - binMin + 1 < 3 * nPeaks)
+      return peaks;
+    double w = spec.GetBinWidth();
+    int nBins = binMax - binMin + 1;
+    fX.resize(nBins);
+    fY.resize(nBins);
+    double maxContent = 0, sum = 0, sumX = 0, sumXX = 0;
+    for (int i = 0; i < nBins; i++)
+    {
+      double x = spec.GetBinCenter(binMin + i), y = spec.Counts[binMin + i] - bkg.Eval(x);
+      fX[i] = x;
+      fY[i] = spec.Counts[binMin + i];
+      maxContent = std::max(maxContent, y);
+      if (y > 0)
+      {
+        sum += y;
+        sumX += y * x;
+        sumXX += y * x * x;
+      }
+    }
+
+    std::vector<double> start = {bkg.p0, bkg.p1};
+    if ((int)seeds.size() == nPeaks)
+      for (int i = 0; i < nPeaks; i++)
+        start.insert(start.end(), {seeds[i].Amplitude, seeds[i].Mean, seeds[i].Sigma});
+    else if (nPeaks == 1 && sum > 0)
+    {
+      double mean = sumX / sum;
+      start.insert(start.end(), {maxContent, mean, TMath::Sqrt(std::max(sumXX / sum - mean * mean, w * w))});
+    }
+    else
+      for (int i = 0; i < nPeaks; i++)
+        start.insert(start.end(), {maxContent, minPos + (maxPos - minPos) * (i + 0.5) / nPeaks, std::max((maxPos - minPos) / (4. * nPeaks), w)});
+
+    GausFitter::FitOptions opt;
+    opt.Cancel = fCancel;
+    GausFitter::FitResult result = fFitter == kCompiled ? GausFitter::Fit(fX.data(), fY.data(), nBins, start, opt) : FitMinuit(start, nBins, w);
+    for (int i = 0; i < nPeaks; i++)
+      peaks.push_back({result.Params[2 + i * 3], result.Params[3 + i * 3], std::fabs(result.Params[4 + i * 3])});
+    if (resultOut)
+      *resultOut = result;
+    return peaks;
+  }
+
+private:
+  GausFitter::FitResult FitMinuit(const std::vector<double> &start, int nBins, double w)
+  {
+    if (!fHist)
+    {
+      fHist = new TH1D(TString::Format("hRegion_%d", fId), "", nBins, fX[0] - w / 2, fX[nBins - 1] + w / 2);
+      fHist->SetDirectory(nullptr);
+    }
+    else
+      fHist->SetBins(nBins, fX[0] - w / 2, fX[nBins - 1] + w / 2);
+    for (int i = 0; i < nBins; i++)
+    {
+      fHist->SetBinContent(i + 1, fY[i]);
+      fHist->SetBinError(i + 1, TMath::Sqrt(std::max(fY[i], 1.)));
+    }
+    int nPar = start.size();
+    TF1 *model = GetModel((nPar - 2) / 3);
+    model->SetRange(fX[0] - w / 2, fX[nBins - 1] + w / 2);
+    model->SetParameters(start.data());
+    model->FixParameter(0, start[0]);
+    model->FixParameter(1, start[1]);
+    TFitResultPtr fit = fHist->Fit(model, "RQNS");
+    GausFitter::FitResult result;
+    result.Covariance.assign(nPar * nPar, 0.);
+    for (int i = 0; i < nPar; i++)
+    {
+      result.Params.push_back(model->GetParameter(i));
+      if (fit.Get())
+        for (int j = 2; j < nPar && i >= 2; j++)
+          result.Covariance[i * nPar + j] = fit->CovMatrix(i, j);
+    }
+    result.Cost = model->GetChisquare();
+    result.NDF = model->GetNDF();
+    result.Converged = (int)fit == 0;
+    return result;
+  }
+
+  TF1 *GetModel(int nPeaks)
+  {
+    TF1 *&model = fModels[nPeaks];
+    if (!model)
+      model = NewPeakModel(TString::Format("SumOfGaus_%d_%d", fId, nPeaks), nPeaks);
+    return model;
+  }
+
+  int fId;
+  EFitter fFitter;
+  const std::atomic<bool> *fCancel;
+  std::vector<double> fX, fY; // region bin centres and counts
+  TH1D *fHist;
+  std::map<int, TF1 *> fModels;
+};
+
+// Gaussian fit of one region over a given background. Peaks are sorted by position,
+// integrals are in counts: divided by channelWidth (the calibration slope for an energy axis),
+// with the error propagated from the fit covariance.
+inline std::vector<PeakResult> AnalyseRegion(FitContext &ctx, const Spectrum &spec, const RegionDef &region, const LinearBackground &bkg, double channelWidth,
+                                             std::vector<GausPeak> *peaksOut = nullptr)
+{
+  GausFitter::FitResult fit;
+  std::vector<GausPeak> peaks = ctx.FitPeaks(spec, bkg, region.Min, region.Max, region.NPeaks, region.Seeds, &fit);
+  std::vector<PeakResult> results;
+  for (int i = 0; i < (int)peaks.size(); i++)
+  {
+    double error, integral = GausFitter::Area(fit, i, region.Min, region.Max, &error);
+    results.push_back({peaks[i].Mean, peaks[i].Sigma * 2.35, integral / channelWidth, error / std::fabs(channelWidth)});
+  }
+  std::vector<int> order(peaks.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&peaks](int l, int r)
+            { return peaks[l].Mean < peaks[r].Mean; });
+  std::vector<PeakResult> sortedResults;
+  std::vector<GausPeak> sortedPeaks;
+  for (int i : order)
+  {
+    sortedResults.push_back(results[i]);
+    sortedPeaks.push_back(peaks[i]);
+  }
+  if (peaksOut)
+    *peaksOut = sortedPeaks;
+  return sortedResults;
+}
+
+// Side-band background plus Gaussian fit of one region
+inline std::vector<PeakResult> AnalyseRegion(FitContext &ctx, const Spectrum &spec, const RegionDef &region, double channelWidth,
+                                             LinearBackground *bkgOut = nullptr, std::vector<GausPeak> *peaksOut = nullptr)
+{
+  LinearBackground bkg = FitSideBands(spec, region.Min, region.Max, region.BorderBins);
+  if (bkgOut)
+    *bkgOut = bkg;
+  return AnalyseRegion(ctx, spec, region, bkg, channelWidth, peaksOut);
+}
+
+// Per-second rate corrected for detection efficiency (with its own uncertainty) and gamma yield
+inline void NormalisePeak(PeakResult &peak, double liveTime, double efficiency = 1, double efficiencyError = 0, double nGamma = 1)
+{
+  peak.Integral /= liveTime;
+  peak.IntegralError /= liveTime;
+  peak.Integral /= efficiency;
+  peak.IntegralError = TMath::Sqrt(std::pow(peak.IntegralError / efficiency, 2) + std::pow(peak.Integral / efficiency * efficiencyError, 2));
+  peak.Integral /= nGamma;
+  peak.IntegralError /= nGamma;
+}
+
+// Efficiency points (x, eff, err) evaluated by linear interpolation like TGraph::Eval
+struct EfficiencyTable
+{
+  std::vector<double> X, Eff, EffError;
+
+  bool Load(const char *fileName)
+  {
+    if (!LoadTable(fileName, X, Eff, EffError))
+      return false;
+    Sort();
+    return true;
+  }
+  // Points in increasing x, as Interpolate needs them
+  void Sort()
+  {
+    std::vector<int> order(X.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), [this](int l, int r)
+              { return X[l] < X[r]; });
+    std::vector<double> x, y, yerr;
+    for (int i : order)
+    {
+      x.push_back(X[i]);
+      y.push_back(Eff[i]);
+      yerr.push_back(EffError[i]);
+    }
+    X.swap(x);
+    Eff.swap(y);
+    EffError.swap(yerr);
+  }
+  double Interpolate(const std::vector<double> &y, double x) const
+  {
+    if (X.size() == 1)
+      return y[0];
+    size_t i = std::upper_bound(X.begin(), X.end(), x) - X.begin();
+    i = std::min(std::max(i, (size_t)1), X.size() - 1);
+    return y[i - 1] + (y[i] - y[i - 1]) * (x - X[i - 1]) / (X[i] - X[i - 1]);
+  }
+  double Eval(double x) const { return Interpolate(Eff, x); }
+  double EvalError(double x) const { return Interpolate(EffError, x); }
+};
+
+// Run task(worker, item) for item in [0, nItems) on nThreads threads (0: all cores)
+inline void ParallelFor(int nItems, int nThreads, const std::function<void(int, int)> &task)
+{
+  if (nThreads <= 0)
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  nThreads = std::min(nThreads, nItems);
+  std::atomic<int> next(0);
+  auto worker = [&](int id)
+  {
+    for (int item = next++; item < nItems; item = next++)
+      task(id, item);
+  };
+  if (nThreads <= 1)
+  {
+    worker(0);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nThreads; i++)
+    threads.emplace_back(worker, i);
+  for (auto &t : threads)
+    t.join();
+}
+
+// Conversions for the GUI, which keeps its spectra in TH1D
+inline Spectrum FromHistogram(const TH1D *hist)
+{
+  Spectrum spec;
+  spec.Xmin = hist->GetXaxis()->GetXmin();
+  spec.Xmax = hist->GetXaxis()->GetXmax();
+  spec.Counts.assign(hist->GetArray() + 1, hist->GetArray() + 1 + hist->GetNbinsX());
+  return spec;
+}
+
+inline void ToHistogram(const Spectrum &spec, TH1D *hist)
+{
+  hist->SetBins(spec.GetNbins(), spec.Xmin, spec.Xmax);
+  std::copy(spec.Counts.begin(), spec.Counts.end(), hist->GetArray() + 1);
+  hist->ResetStats();
+}
+
+} // namespace SpectrumAnalysis
+
+#endif
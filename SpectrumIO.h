@@ -0,0 +1,276 @@
+// Fast loading of the text tables read by spectrum.C (spectra, calibration, efficiency).
+// The file is memory mapped and parsed without locale; the parsed numbers are stored in a
+// binary sidecar "<file>.spcache" (header, axis, values, checksum of the source) so that the
+// next open of an unchanged file is a single copy.
+#ifndef SpectrumIO_h
+#define SpectrumIO_h
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace SpectrumIO
+{
+
+// Read-only view of a whole file, mmap()ed when possible
+class MappedFile
+{
+public:
+  explicit MappedFile(const char *fileName) : fData(nullptr), fSize(0), fMapped(false)
+  {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      fSize = st.st_size;
+      void *addr = mmap(nullptr, fSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED)
+      {
+        madvise(addr, fSize, MADV_SEQUENTIAL);
+        fData = (const char *)addr;
+        fMapped = true;
+      }
+      else
+      {
+        fBuffer.resize(fSize);
+        size_t done = 0;
+        ssize_t n;
+        while (done < fSize && (n = read(fd, &fBuffer[done], fSize - done)) > 0)
+          done += n;
+        fBuffer.resize(done);
+        fSize = done;
+        fData = fBuffer.data();
+      }
+    }
+    close(fd);
+  }
+  ~MappedFile()
+  {
+    if (fMapped)
+      munmap((void *)fData, fSize);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool IsOpen() const { return fData != nullptr; }
+  const char *Data() const { return fData; }
+  size_t Size() const { return fSize; }
+
+private:
+  const char *fData;
+  size_t fSize;
+  bool fMapped;
+  std::vector<char> fBuffer;
+};
+
+// 64-bit hash over 8-byte words, used to recognise an unchanged source or a damaged sidecar
+inline uint64_t Checksum(const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ size, w;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    std::memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+  w = 0;
+  std::memcpy(&w, p + i, size - i);
+  h = (h ^ w) * 0x100000001b3ULL;
+  return h ^ (h >> 32);
+}
+
+// Whitespace separated numbers, stops at the first token that is not a number (as "inFile >> x" does)
+inline void ParseNumbers(const char *begin, const char *end, std::vector<double> &values)
+{
+  const char *p = begin;
+  while (true)
+  {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      p++;
+    if (p >= end)
+      return;
+    if (*p == '+')
+      p++;
+    double value;
+#if defined(__cpp_lib_to_chars) || (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11)
+    std::from_chars_result res = std::from_chars(p, end, value);
+    if (res.ec != std::errc())
+      return;
+    p = res.ptr;
+#else
+    char token[64];
+    size_t len = 0;
+    while (p + len < end && len < sizeof(token) - 1 && !std::isspace((unsigned char)p[len]))
+      len++;
+    std::memcpy(token, p, len);
+    token[len] = 0;
+    char *stop;
+    value = std::strtod(token, &stop);
+    if (stop == token)
+      return;
+    p += stop - token;
+#endif
+    values.push_back(value);
+  }
+}
+
+enum ECacheKind
+{
+  kSpectrumCache = 1,
+  kTableCache = 2,
+};
+
+struct CacheHeader
+{
+  char Magic[8];
+  uint32_t Version, Kind, NColumns, Reserved;
+  uint64_t SourceSize;
+  int64_t SourceTime;
+  uint64_t SourceChecksum;
+  uint64_t NValues;
+  double Xmin, Xmax;
+  uint64_t ValuesChecksum;
+};
+
+const char kCacheMagic[8] = {'S', 'P', 'C', 'A', 'C', 'H', 'E', 0};
+const uint32_t kCacheVersion = 1;
+
+inline std::string CacheFileName(const char *fileName) { return std::string(fileName) + ".spcache"; }
+
+inline bool SourceStat(const char *fileName, uint64_t &size, int64_t &time)
+{
+  std::error_code ec;
+  size = std::filesystem::file_size(fileName, ec);
+  if (ec)
+    return false;
+  time = std::filesystem::last_write_time(fileName, ec).time_since_epoch().count();
+  return !ec;
+}
+
+// Sidecar values if it was written for this source; an equal-size source with a new
+// modification time is accepted when its checksum still matches
+inline bool ReadCache(const char *fileName, uint32_t kind, uint32_t nColumns, CacheHeader &header, std::vector<double> &values)
+{
+  uint64_t size;
+  int64_t time;
+  if (!SourceStat(fileName, size, time))
+    return false;
+  MappedFile cache(CacheFileName(fileName).c_str());
+  if (!cache.IsOpen() || cache.Size() < sizeof(CacheHeader))
+    return false;
+  std::memcpy(&header, cache.Data(), sizeof(CacheHeader));
+  if (std::memcmp(header.Magic, kCacheMagic, 8) || header.Version != kCacheVersion || header.Kind != kind || header.NColumns != nColumns ||
+      header.SourceSize != size || cache.Size() != sizeof(CacheHeader) + header.NValues * sizeof(double))
+    return false;
+  const char *payload = cache.Data() + sizeof(CacheHeader);
+  if (Checksum(payload, header.NValues * sizeof(double)) != header.ValuesChecksum)
+    return false;
+  if (header.SourceTime != time)
+  {
+    MappedFile source(fileName);
+    if (!source.IsOpen() || Checksum(source.Data(), source.Size()) != header.SourceChecksum)
+      return false;
+  }
+  values.resize(header.NValues);
+  std::memcpy(values.data(), payload, header.NValues * sizeof(double));
+  return true;
+}
+
+// Written next to the source through a temporary file; silently skipped on read-only directories
+inline void WriteCache(const char *fileName, uint64_t sourceChecksum, uint32_t kind, uint32_t nColumns, double xmin, double xmax, const std::vector<double> &values)
+{
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.Magic, kCacheMagic, 8);
+  header.Version = kCacheVersion;
+  header.Kind = kind;
+  header.NColumns = nColumns;
+  if (!SourceStat(fileName, header.SourceSize, header.SourceTime))
+    return;
+  header.SourceChecksum = sourceChecksum;
+  header.NValues = values.size();
+  header.Xmin = xmin;
+  header.Xmax = xmax;
+  header.ValuesChecksum = Checksum(values.data(), values.size() * sizeof(double));
+  std::string cacheName = CacheFileName(fileName), tmpName = cacheName + ".tmp";
+  {
+    std::ofstream out(tmpName, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return;
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)values.data(), values.size() * sizeof(double));
+    if (!out)
+    {
+      out.close();
+      std::remove(tmpName.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmpName.c_str(), cacheName.c_str()))
+    std::remove(tmpName.c_str());
+}
+
+// Two-column spectrum (x, counts): counts are |y|, the axis spans the first to the last x
+inline bool LoadSpectrum(const char *fileName, std::vector<double> &counts, double &xmin, double &xmax)
+{
+  CacheHeader header;
+  if (ReadCache(fileName, kSpectrumCache, 2, header, counts))
+  {
+    xmin = header.Xmin;
+    xmax = header.Xmax;
+    return true;
+  }
+  MappedFile source(fileName);
+  if (!source.IsOpen())
+    return false;
+  std::vector<double> values;
+  values.reserve(source.Size() / 6);
+  ParseNumbers(source.Data(), source.Data() + source.Size(), values);
+  size_t n = values.size() / 2;
+  if (n < 2)
+    return false;
+  counts.resize(n);
+  for (size_t i = 0; i < n; i++)
+    counts[i] = std::fabs(values[2 * i + 1]);
+  xmin = values[0];
+  xmax = values[2 * (n - 1)];
+  WriteCache(fileName, Checksum(source.Data(), source.Size()), kSpectrumCache, 2, xmin, xmax, counts);
+  return true;
+}
+
+// Rows of nColumns numbers, returned row after row
+inline bool LoadTable(const char *fileName, uint32_t nColumns, std::vector<double> &values)
+{
+  CacheHeader header;
+  if (ReadCache(fileName, kTableCache, nColumns, header, values))
+    return true;
+  MappedFile source(fileName);
+  if (!source.IsOpen())
+    return false;
+  values.clear();
+  ParseNumbers(source.Data(), source.Data() + source.Size(), values);
+  values.resize(values.size() / nColumns * nColumns);
+  WriteCache(fileName, Checksum(source.Data(), source.Size()), kTableCache, nColumns, 0, 0, values);
+  return true;
+}
+
+} // namespace SpectrumIO
+
+#endif
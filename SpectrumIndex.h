@@ -0,0 +1,164 @@
+// Index built once per spectrum so that work on large spectra no longer scales with the
+// number of channels: cumulative sums of c_i and i*c_i give region sums, side-band lines and
+// combined channels in O(1) per output value, and a min/max decimation pyramid (groups of
+// 2, 4, 8, ... bins) lets the GUI draw a view with about one point pair per screen pixel.
+#ifndef SpectrumIndex_h
+#define SpectrumIndex_h
+
+#include "SpectrumAnalysis.h"
+#include <vector>
+#include <algorithm>
+
+namespace SpectrumAnalysis
+{
+
+class SpectrumIndex
+{
+public:
+  SpectrumIndex() {}
+  explicit SpectrumIndex(const std::vector<double> &counts) { Build(counts); }
+
+  void Build(const std::vector<double> &counts)
+  {
+    int n = counts.size();
+    // long double keeps the differences of large running sums exact for integer counts
+    fSum.assign(n + 1, 0);
+    fMoment.assign(n + 1, 0);
+    for (int i = 0; i < n; i++)
+    {
+      fSum[i + 1] = fSum[i] + counts[i];
+      fMoment[i + 1] = fMoment[i] + (long double)i * counts[i];
+    }
+    // each level pairs the groups of the one below; an odd last group is carried over alone
+    fMin.clear();
+    fMax.clear();
+    for (int below = n; below > 1; below = (below + 1) / 2)
+    {
+      int size = (below + 1) / 2;
+      std::vector<float> levelMin(size), levelMax(size);
+      for (int b = 0; b < size; b++)
+      {
+        int i0 = 2 * b, i1 = std::min(2 * b + 1, below - 1);
+        if (fMin.empty())
+        {
+          levelMin[b] = std::min(counts[i0], counts[i1]);
+          levelMax[b] = std::max(counts[i0], counts[i1]);
+        }
+        else
+        {
+          levelMin[b] = std::min(fMin.back()[i0], fMin.back()[i1]);
+          levelMax[b] = std::max(fMax.back()[i0], fMax.back()[i1]);
+        }
+      }
+      fMin.push_back(std::move(levelMin));
+      fMax.push_back(std::move(levelMax));
+    }
+  }
+
+  int GetNbins() const { return fSum.empty() ? 0 : fSum.size() - 1; }
+
+  // Sum of counts in bins [first, last], clamped to the spectrum
+  double Sum(int first, int last) const
+  {
+    Clamp(first, last);
+    return first > last ? 0 : (double)(fSum[last + 1] - fSum[first]);
+  }
+
+  // Straight line through borderBins bins left of binMin and right of binMax (both edge bins
+  // included), same result as FitSideBands; x of bin i is xmin + (i + 0.5)*w
+  LinearBackground SideBands(int binMin, int binMax, int borderBins, double xmin, double w) const
+  {
+    // least squares in bin units u = i - binMin, then moved to the x axis
+    long double n = 0, su = 0, suu = 0, sy = 0, suy = 0;
+    int ranges[2][2] = {{binMin - borderBins + 1, binMin}, {binMax, binMax + borderBins - 1}};
+    for (auto &range : ranges)
+    {
+      int first = range[0], last = range[1];
+      Clamp(first, last);
+      if (first > last)
+        continue;
+      long double m = last - first + 1, u0 = first - binMin, u1 = last - binMin;
+      n += m;
+      su += (u0 + u1) * m / 2;
+      suu += (u1 * (u1 + 1) * (2 * u1 + 1) - (u0 - 1) * u0 * (2 * u0 - 1)) / 6;
+      long double y = fSum[last + 1] - fSum[first];
+      sy += y;
+      suy += fMoment[last + 1] - fMoment[first] - binMin * y;
+    }
+    LinearBackground line;
+    if (n == 0)
+      return line;
+    long double det = n * suu - su * su;
+    if (n < 2 || det == 0)
+    {
+      line.p0 = sy / n;
+      return line;
+    }
+    long double slope = (n * suy - su * sy) / det, intercept = (sy - slope * su) / n;
+    // y = intercept + slope*u with u = (x - xmin)/w - 0.5 - binMin
+    line.p1 = slope / w;
+    line.p0 = intercept - slope * (xmin / w + 0.5 + binMin);
+    return line;
+  }
+
+  // Groups of nCombined bins averaged, as SpectrumAnalysis::Rebin, from the cumulative sums
+  Spectrum Rebin(const Spectrum &spec, int nCombined) const
+  {
+    if (nCombined <= 1)
+      return spec;
+    Spectrum out;
+    int nBinsNew = GetNbins() / nCombined;
+    out.Counts.resize(nBinsNew);
+    for (int i = 0; i < nBinsNew; i++)
+      out.Counts[i] = (double)((fSum[(i + 1) * nCombined] - fSum[i * nCombined]) / nCombined);
+    out.Xmin = spec.Xmin;
+    out.Xmax = spec.Xmin + nBinsNew * nCombined * spec.GetBinWidth();
+    return out;
+  }
+
+  // Min/max envelope of bins [first, last] for a plot nPixels wide: groups of the largest
+  // power-of-two size with at least one group per pixel. center is the middle of each group
+  // in bin units (bin i spans [i, i + 1)). Returns the group size; 1 means the range is
+  // small enough to draw bin by bin and nothing is filled.
+  int Envelope(int first, int last, int nPixels, std::vector<double> &center, std::vector<double> &low, std::vector<double> &high) const
+  {
+    Clamp(first, last);
+    center.clear();
+    low.clear();
+    high.clear();
+    int level = -1;
+    while (level + 1 < (int)fMin.size() && (2 << (level + 1)) * nPixels <= last - first + 1)
+      level++;
+    if (level < 0)
+      return 1;
+    int size = 2 << level;
+    const std::vector<float> &levelMin = fMin[level], &levelMax = fMax[level];
+    for (int b = first / size; b <= last / size; b++)
+    {
+      center.push_back((b + 0.5) * size);
+      low.push_back(levelMin[b]);
+      high.push_back(levelMax[b]);
+    }
+    return size;
+  }
+
+private:
+  void Clamp(int &first, int &last) const
+  {
+    first = std::max(first, 0);
+    last = std::min(last, GetNbins() - 1);
+  }
+
+  std::vector<long double> fSum, fMoment;   // fSum[i] = sum of c_j, fMoment[i] = sum of j*c_j, j < i
+  std::vector<std::vector<float>> fMin, fMax; // level l: groups of 2^(l+1) bins
+};
+
+// FitSideBands through the index, independent of the side-band width
+inline LinearBackground FitSideBands(const SpectrumIndex &index, const Spectrum &spec, double minPos, double maxPos, int borderBins)
+{
+  return index.SideBands(spec.FindBin(minPos), spec.FindBin(maxPos), borderBins, spec.Xmin, spec.GetBinWidth());
+}
+
+} // namespace SpectrumAnalysis
+
+#endif
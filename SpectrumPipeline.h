@@ -0,0 +1,165 @@
+// Derived spectra behind the views of spectrum.C: source, background and net (source minus
+// background, negative bins set to zero; only for the same binning), each rebinned and
+// calibrated on demand. Every stage
+// remembers the inputs it was computed from (versions of the stages above, rebin factor,
+// calibration) and is recomputed only when one of them changes, so redrawing an unchanged
+// view costs nothing and changing the calibration only moves the axis. Stages holding new
+// counts also carry a SpectrumIndex, built on first use; rebinning reads from it.
+#ifndef SpectrumPipeline_h
+#define SpectrumPipeline_h
+
+#include "SpectrumAnalysis.h"
+#include "SpectrumIndex.h"
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+namespace SpectrumAnalysis
+{
+
+enum EView
+{
+  kSourceView,
+  kBackgroundView,
+  kNetView,
+  kNViews,
+};
+
+class Pipeline
+{
+public:
+  Pipeline() : fLastVersion(0), fCalibrated(false), fA(1), fB(0), fRebin(1) {}
+
+  void SetSource(Spectrum spec) { SetInput(fInput[kSourceView], std::move(spec)); }
+  void SetBackground(Spectrum spec) { SetInput(fInput[kBackgroundView], std::move(spec)); }
+  bool Has(int view) const
+  {
+    if (view == kNetView)
+      return Has(kSourceView) && Has(kBackgroundView) && SameBinning(fInput[kSourceView].Data, fInput[kBackgroundView].Data);
+    return fInput[view].Version != 0;
+  }
+  // Same number of bins on the same axis, to within a millionth of a bin
+  static bool SameBinning(const Spectrum &l, const Spectrum &r)
+  {
+    double tolerance = 1e-6 * l.GetBinWidth();
+    return l.GetNbins() == r.GetNbins() && std::fabs(l.Xmin - r.Xmin) <= tolerance && std::fabs(l.Xmax - r.Xmax) <= tolerance;
+  }
+
+  // Axis x' = a*x + b when enabled
+  void SetCalibration(bool enabled, double a, double b)
+  {
+    fCalibrated = enabled;
+    fA = a;
+    fB = b;
+  }
+  // Groups of nCombined bins averaged, as SpectrumAnalysis::Rebin
+  void SetRebin(int nCombined) { fRebin = std::max(1, nCombined); }
+
+  // The view as shown: rebinned, then calibrated (rebinning commutes with the linear axis map)
+  const Spectrum &Get(int view) { return *Update(view).first; }
+  // Changes whenever the content of Get(view) changes; 0 while the view has no input
+  uint64_t GetVersion(int view) { return Has(view) ? Update(view).second : 0; }
+  // Index over the bins of Get(view)
+  const SpectrumIndex &GetIndex(int view)
+  {
+    Stage *counts;
+    Update(view, &counts);
+    return IndexOf(*counts);
+  }
+
+private:
+  struct Stage
+  {
+    Spectrum Data;
+    uint64_t Version = 0;     // 0: never computed
+    std::vector<double> Key;  // inputs Data was computed from
+    SpectrumIndex Index;
+    uint64_t IndexVersion = 0; // Version Index was built for
+  };
+
+  const SpectrumIndex &IndexOf(Stage &stage)
+  {
+    if (stage.IndexVersion != stage.Version)
+    {
+      stage.Index.Build(stage.Data.Counts);
+      stage.IndexVersion = stage.Version;
+    }
+    return stage.Index;
+  }
+
+  void SetInput(Stage &input, Spectrum &&spec)
+  {
+    input.Data = std::move(spec);
+    input.Version = ++fLastVersion;
+  }
+
+  // True (and the new key stored) when the stage must be recomputed
+  bool IsStale(Stage &stage, const std::vector<double> &key)
+  {
+    if (stage.Version && stage.Key == key)
+      return false;
+    stage.Key = key;
+    stage.Version = ++fLastVersion;
+    return true;
+  }
+
+  // countsOut: the last stage that changed the counts (the calibration only moves the axis)
+  std::pair<const Spectrum *, uint64_t> Update(int view, Stage **countsOut = nullptr)
+  {
+    // base: input or net
+    Stage *counts = &fInput[view == kNetView ? kSourceView : view];
+    const Spectrum *base = &counts->Data;
+    uint64_t version = counts->Version;
+    if (view == kNetView)
+    {
+      const Stage &source = fInput[kSourceView], &background = fInput[kBackgroundView];
+      if (IsStale(fNet, {(double)source.Version, (double)background.Version}))
+      {
+        fNet.Data = source.Data;
+        if (SameBinning(source.Data, background.Data))
+          for (size_t i = 0; i < fNet.Data.Counts.size(); i++)
+            fNet.Data.Counts[i] = std::max(fNet.Data.Counts[i] - background.Data.Counts[i], 0.);
+      }
+      counts = &fNet;
+      base = &fNet.Data;
+      version = fNet.Version;
+    }
+    if (fRebin > 1)
+    {
+      Stage &rebinned = fRebinned[view];
+      if (IsStale(rebinned, {(double)version, (double)fRebin}))
+        rebinned.Data = IndexOf(*counts).Rebin(*base, fRebin);
+      counts = &rebinned;
+      base = &rebinned.Data;
+      version = rebinned.Version;
+    }
+    if (fCalibrated)
+    {
+      // counts are copied only when the stage above changed, otherwise just the axis moves
+      Stage &calibrated = fCalibratedView[view];
+      bool countsChanged = calibrated.Key.empty() || calibrated.Key[0] != (double)version;
+      if (IsStale(calibrated, {(double)version, fA, fB}))
+      {
+        if (countsChanged)
+          calibrated.Data.Counts = base->Counts;
+        calibrated.Data.Xmin = base->Xmin * fA + fB;
+        calibrated.Data.Xmax = base->Xmax * fA + fB;
+      }
+      base = &calibrated.Data;
+      version = calibrated.Version;
+    }
+    if (countsOut)
+      *countsOut = counts;
+    return {base, version};
+  }
+
+  uint64_t fLastVersion;
+  Stage fInput[2], fNet, fRebinned[kNViews], fCalibratedView[kNViews];
+  bool fCalibrated;
+  double fA, fB;
+  int fRebin;
+};
+
+} // namespace SpectrumAnalysis
+
+#endif
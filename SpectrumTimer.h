@@ -0,0 +1,197 @@
+// Scoped timers for the interactive path and the benchmarks. A Scope times the block it lives
+// in and, through Stage(), consecutive stages inside it. The outermost open scope of a thread
+// is a frame (one interaction: a load, a redraw); the events of the last finished frame are
+// kept for display. Every event also goes to a bounded trace that can be written in the
+// trace-event JSON format (chrome://tracing, ui.perfetto.dev) and attached to a report.
+#ifndef SpectrumTimer_h
+#define SpectrumTimer_h
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <functional>
+
+namespace SpectrumTimer
+{
+
+struct Event
+{
+  std::string Name;
+  int64_t Start, Duration; // ns since the recorder was created
+  int Depth;               // 0: frame
+  int Thread;              // small id, in order of first use
+};
+
+class Recorder
+{
+public:
+  explicit Recorder(size_t maxTraceEvents = 100000) : fOrigin(std::chrono::steady_clock::now()), fMaxTrace(maxTraceEvents) {}
+
+  int64_t Now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - fOrigin).count(); }
+
+  // Called with the events of every finished frame (frame last), on the thread that ran it
+  void SetFrameCallback(std::function<void(const std::vector<Event> &)> callback)
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fCallback = callback;
+  }
+
+  // Used by Scope: Open returns the depth of the new event, Close records it
+  int Open()
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return GetThread().Depth++;
+  }
+  void Close(const char *name, int64_t start, int depth)
+  {
+    std::vector<Event> frame;
+    std::function<void(const std::vector<Event> &)> callback;
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      ThreadState &thread = GetThread();
+      thread.Depth = depth;
+      Event event = {name, start, Now() - start, depth, thread.Id};
+      fTrace.push_back(event);
+      if (fTrace.size() > fMaxTrace)
+        fTrace.pop_front();
+      thread.Frame.push_back(event);
+      if (depth > 0)
+        return;
+      fLast.swap(thread.Frame);
+      thread.Frame.clear();
+      frame = fLast;
+      callback = fCallback;
+    }
+    if (callback)
+      callback(frame);
+  }
+
+  std::vector<Event> GetLastFrame() const
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fLast;
+  }
+
+  // "DoDraw 12.3 ms: update view 1.2, fit 0.31, draw 8.1" for the stages right below the frame
+  std::string FormatLastFrame() const { return Format(GetLastFrame()); }
+  static std::string Format(std::vector<Event> frame)
+  {
+    if (frame.empty())
+      return "";
+    std::sort(frame.begin(), frame.end() - 1, [](const Event &l, const Event &r)
+              { return l.Start < r.Start; });
+    char text[128];
+    snprintf(text, sizeof(text), "%s %.3g ms", frame.back().Name.c_str(), frame.back().Duration * 1e-6);
+    std::string out = text;
+    const char *separator = ": ";
+    for (size_t i = 0; i + 1 < frame.size(); i++)
+      if (frame[i].Depth == 1)
+      {
+        snprintf(text, sizeof(text), "%s%s %.3g", separator, frame[i].Name.c_str(), frame[i].Duration * 1e-6);
+        out += text;
+        separator = ", ";
+      }
+    return out;
+  }
+
+  bool DumpTrace(const char *fileName) const
+  {
+    FILE *out = fopen(fileName, "w");
+    if (!out)
+      return false;
+    std::lock_guard<std::mutex> lock(fMutex);
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t i = 0; i < fTrace.size(); i++)
+    {
+      std::string name;
+      for (char c : fTrace[i].Name)
+        name += c == '"' || c == '\\' ? std::string("\\") + c : std::string(1, c);
+      fprintf(out, "  {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d}%s\n", name.c_str(),
+              fTrace[i].Start * 1e-3, fTrace[i].Duration * 1e-3, fTrace[i].Thread, i + 1 < fTrace.size() ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    return fclose(out) == 0;
+  }
+
+private:
+  struct ThreadState
+  {
+    int Id = 0, Depth = 0;
+    std::vector<Event> Frame; // finished events of the open frame
+  };
+
+  ThreadState &GetThread()
+  {
+    auto found = fThreads.find(std::this_thread::get_id());
+    if (found != fThreads.end())
+      return found->second;
+    ThreadState &thread = fThreads[std::this_thread::get_id()];
+    thread.Id = fThreads.size();
+    return thread;
+  }
+
+  mutable std::mutex fMutex;
+  std::chrono::steady_clock::time_point fOrigin;
+  size_t fMaxTrace;
+  std::deque<Event> fTrace;
+  std::map<std::thread::id, ThreadState> fThreads;
+  std::vector<Event> fLast;
+  std::function<void(const std::vector<Event> &)> fCallback;
+};
+
+// The recorder of the GUI
+inline Recorder &Global()
+{
+  static Recorder recorder;
+  return recorder;
+}
+
+class Scope
+{
+public:
+  explicit Scope(const char *name, Recorder &recorder = Global())
+      : fRecorder(recorder), fName(name), fDepth(recorder.Open()), fStart(recorder.Now()), fStageName(0), fStageDepth(0), fStageStart(0) {}
+  ~Scope()
+  {
+    EndStage();
+    fRecorder.Close(fName, fStart, fDepth);
+  }
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+  // Ends the running stage of this scope, if any, and starts the next one
+  void Stage(const char *name)
+  {
+    EndStage();
+    fStageName = name;
+    fStageDepth = fRecorder.Open();
+    fStageStart = fRecorder.Now();
+  }
+
+private:
+  void EndStage()
+  {
+    if (fStageName)
+      fRecorder.Close(fStageName, fStageStart, fStageDepth);
+    fStageName = 0;
+  }
+
+  Recorder &fRecorder;
+  const char *fName;
+  int fDepth;
+  int64_t fStart;
+  const char *fStageName;
+  int fStageDepth;
+  int64_t fStageStart;
+};
+
+} // namespace SpectrumTimer
+
+#endif